@@ -0,0 +1,113 @@
+// Throughput of Unit::from_file compared to the stringstream based
+// implementation it replaced. Usage: vhdlmake_bench_lexer [size in MB] [file size in KB]
+#include "Unit.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// Previous implementation: read into a stringstream, copy for hashing and
+// allocate a lower case string for every whitespace separated token
+static size_t legacy_from_file(const std::string& path) {
+    static std::hash<std::string> hasher;
+    std::ifstream file(path);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    file.close();
+
+    size_t hash = hasher(buffer.str());
+
+    std::vector<std::string> tokens;
+    std::string tmp;
+    while(buffer >> tmp) {
+        std::transform(tmp.begin(), tmp.end(), tmp.begin(), ::tolower);
+        tokens.emplace_back(tmp);
+    }
+
+    return hash + tokens.size();
+}
+
+static std::string generate(size_t bytes) {
+    std::stringstream stream;
+    stream << "library ieee;\nuse ieee.std_logic_1164.all;\nuse work.Bench_Pkg.all;\n\n";
+    for(size_t i = 0; stream.tellp() < static_cast<std::streamoff>(bytes); i++) {
+        stream << "-- Component number " << i << " with some commentary text\n"
+               << "entity Comp_" << i << " is\n"
+               << "    port (\n"
+               << "        clk   : in  std_logic;\n"
+               << "        data  : in  std_logic_vector(31 downto 0);\n"
+               << "        q     : out std_logic_vector(31 downto 0)\n"
+               << "    );\n"
+               << "end entity;\n\n"
+               << "architecture rtl of comp_" << i << " is\n"
+               << "    signal reg : std_logic_vector(31 downto 0) := (others => '0');\n"
+               << "begin\n"
+               << "    process(clk) begin\n"
+               << "        if rising_edge(clk) then\n"
+               << "            reg <= data; report \"value -- not a comment\";\n"
+               << "        end if;\n"
+               << "    end process;\n"
+               << "    q <= reg;\n"
+               << "end architecture;\n\n";
+    }
+    return stream.str();
+}
+
+template<typename F>
+static double measure(const std::string& name, size_t bytes, int rounds, F fn) {
+    double best = 1e30;
+    for(int r = 0; r < rounds; r++) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+
+    double throughput = bytes / best / (1024.0 * 1024.0);
+    std::cout << name << ": " << throughput << " MB/s" << std::endl;
+    return throughput;
+}
+
+int main(int argc, char *argv[]) {
+    size_t megabytes = argc > 1 ? std::stoul(argv[1]) : 32;
+    size_t kilobytes = argc > 2 ? std::stoul(argv[2]) : 32;
+    fs::path directory = fs::temp_directory_path() / ("vhdlmake_bench_" + std::to_string(getpid()));
+    fs::create_directories(directory);
+
+    // Real projects consist of many small files, so the per file overhead counts too
+    std::string source = generate(kilobytes * 1024);
+    size_t count = std::max<size_t>(1, megabytes * 1024 / kilobytes);
+    std::vector<std::string> paths;
+    for(size_t i = 0; i < count; i++) {
+        paths.push_back((directory / ("file" + std::to_string(i) + ".vhdl")).string());
+        std::ofstream file(paths.back());
+        file << source;
+    }
+
+    size_t bytes = source.size() * count;
+    std::cout << count << " files, " << source.size() << " bytes each" << std::endl;
+
+    volatile size_t sink = 0;
+    double before = measure("stringstream", bytes, 5, [&] {
+        for(const auto& path : paths) {
+            sink = sink + legacy_from_file(path);
+        }
+    });
+    double after = measure("mmap lexer", bytes, 5, [&] {
+        for(const auto& path : paths) {
+            sink = sink + vm::Unit::from_file(path).hash;
+        }
+    });
+    std::cout << "speedup: " << after / before << "x" << std::endl;
+
+    fs::remove_all(directory);
+    return 0;
+}
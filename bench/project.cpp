@@ -0,0 +1,275 @@
+// Times every phase of building the dependency graph on a generated project.
+// Prints one JSON object per project size, so runs can be compared by script.
+//
+// Usage: vhdlmake_bench [--files N[,N...]] [--fan-out N] [--fan-in N]
+//                       [--depth N] [--size BYTES] [--changed PERCENT] [--rounds N]
+#include "DependencyGraph.hpp"
+#include "Scanner.hpp"
+#include "Cache.hpp"
+#include "Constants.hpp"
+#include "Utility.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+struct Config {
+    std::vector<size_t> files {1000, 10000};
+    size_t fan_out = 4;     // references per design file
+    size_t fan_in = 16;     // average number of files referencing an entity
+    size_t depth = 4;       // layers of packages using each other
+    size_t size = 4096;     // approximate bytes per design file
+    double changed = 1.0;   // percentage of files marked as changed
+    int rounds = 3;
+};
+
+static std::string entity_file(size_t index, const std::vector<std::string>& packages,
+                               const std::vector<size_t>& instances, size_t size) {
+    std::stringstream out;
+    out << "library ieee;\nuse ieee.std_logic_1164.all;\n";
+    for(const auto& package : packages) {
+        out << "use work." << package << ".all;\n";
+    }
+
+    out << "\nentity comp_" << index << " is\n"
+        << "    port (\n"
+        << "        clk  : in  std_logic;\n"
+        << "        data : in  std_logic_vector(31 downto 0);\n"
+        << "        q    : out std_logic_vector(31 downto 0)\n"
+        << "    );\n"
+        << "end entity;\n\n"
+        << "architecture rtl of comp_" << index << " is\n"
+        << "    signal reg : std_logic_vector(31 downto 0) := (others => '0');\n"
+        << "begin\n";
+
+    for(size_t instance : instances) {
+        out << "    u_" << instance << " : entity work.comp_" << instance
+            << " port map (clk => clk, data => reg, q => open);\n";
+    }
+
+    out << "    process(clk) begin\n"
+        << "        if rising_edge(clk) then\n";
+    for(size_t line = 0; out.tellp() < static_cast<std::streamoff>(size); line++) {
+        out << "            -- filler " << line << "\n"
+            << "            reg <= data xor reg; report \"line " << line << "\";\n";
+    }
+    out << "        end if;\n"
+        << "    end process;\n"
+        << "    q <= reg;\n"
+        << "end architecture;\n";
+
+    return out.str();
+}
+
+static std::string package_file(const std::string& name, const std::vector<std::string>& uses) {
+    std::stringstream out;
+    out << "library ieee;\nuse ieee.std_logic_1164.all;\n";
+    for(const auto& use : uses) {
+        out << "use work." << use << ".all;\n";
+    }
+
+    out << "\npackage " << name << " is\n"
+        << "    constant WIDTH : natural := 32;\n"
+        << "end package;\n\n"
+        << "package body " << name << " is\n"
+        << "end package body;\n";
+
+    return out.str();
+}
+
+// Writes the project into `directory` and returns the relative paths of all files
+static std::vector<std::string> generate(const fs::path& directory, size_t files, const Config& config) {
+    std::mt19937 random(files);
+    std::vector<std::string> paths;
+
+    // Packages form `depth` layers, every package uses fan-out packages of the layer below
+    size_t package_count = std::max<size_t>(config.depth, files / 10);
+    size_t per_layer = std::max<size_t>(1, package_count / std::max<size_t>(1, config.depth));
+    std::vector<std::string> packages;
+    fs::create_directories(directory / "pkg");
+    for(size_t i = 0; i < package_count; i++) {
+        size_t layer = i / per_layer;
+        std::vector<std::string> uses;
+        if(layer > 0) {
+            std::uniform_int_distribution<size_t> pick((layer - 1) * per_layer, layer * per_layer - 1);
+            for(size_t n = 0; n < config.fan_out; n++) {
+                uses.push_back(packages[pick(random)]);
+            }
+        }
+
+        packages.push_back("pkg_" + std::to_string(i));
+        paths.push_back("pkg/" + packages.back() + ".vhdl");
+        std::ofstream(directory / paths.back()) << package_file(packages.back(), uses);
+    }
+
+    // Only every stride-th entity is instantiated, which gives the requested fan-in
+    size_t entity_count = files > package_count ? files - package_count : 0;
+    size_t stride = std::max<size_t>(1, config.fan_in / std::max<size_t>(1, config.fan_out));
+    std::uniform_int_distribution<size_t> pick_package(0, package_count - 1);
+    for(size_t i = 0; i < entity_count; i++) {
+        std::vector<size_t> instances;
+        if(i >= stride) {
+            std::uniform_int_distribution<size_t> pick(0, (i - 1) / stride);
+            for(size_t n = 0; n < config.fan_out; n++) {
+                instances.push_back(pick(random) * stride);
+            }
+        }
+
+        std::string dir = "rtl/" + std::to_string(i / 1000);
+        fs::create_directories(directory / dir);
+        paths.push_back(dir + "/comp_" + std::to_string(i) + ".vhdl");
+        std::ofstream(directory / paths.back())
+            << entity_file(i, {packages[pick_package(random)]}, instances, config.size);
+    }
+
+    return paths;
+}
+
+template<typename F>
+static double measure(int rounds, F fn) {
+    double best = 1e30;
+    for(int r = 0; r < rounds; r++) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+static void run(size_t files, const Config& config) {
+    fs::path directory = fs::temp_directory_path() / ("vhdlmake_bench_" + std::to_string(getpid()));
+    fs::remove_all(directory);
+    generate(directory, files, config);
+
+    fs::path previous = fs::current_path();
+    fs::current_path(directory);
+
+    std::vector<std::pair<std::string, double>> phases;
+    size_t workers = std::thread::hardware_concurrency();
+
+    std::vector<std::string> paths;
+    phases.emplace_back("scan", measure(config.rounds, [&] {
+        paths = vm::scan_sources(".");
+    }));
+
+    std::vector<vm::Unit> units(paths.size());
+    phases.emplace_back("parse", measure(config.rounds, [&] {
+        vm::parallel_for(paths.size(), workers, [&](size_t i) {
+            units[i] = vm::Unit::from_file(paths[i]);
+            units[i].stat = vm::FileStat::from_file(paths[i]);
+        });
+    }));
+
+    std::vector<uint8_t> changed(units.size(), 0);
+    std::unique_ptr<vm::DependencyGraph> graph;
+    phases.emplace_back("resolve", measure(config.rounds, [&] {
+        graph = std::make_unique<vm::DependencyGraph>(units, changed);
+    }));
+
+    // Mark a random selection of files, the same one in every round
+    std::vector<std::string> selection;
+    std::mt19937 random(files);
+    std::bernoulli_distribution pick(config.changed / 100.0);
+    for(const auto& path : paths) {
+        if(pick(random)) {
+            selection.push_back(path);
+        }
+    }
+
+    phases.emplace_back("partial_dag", measure(config.rounds, [&] {
+        graph->invalidate(selection);
+    }));
+
+    size_t update_count = 0;
+    phases.emplace_back("update_list", measure(config.rounds, [&] {
+        update_count = graph->get_update_list().size();
+    }));
+
+    phases.emplace_back("cache_save", measure(config.rounds, [&] {
+        graph->save_cache();
+    }));
+
+    phases.emplace_back("cache_load", measure(config.rounds, [&] {
+        vm::Cache cache {std::string(vm::C_CACHE_FILE)};
+        for(size_t i = 0; i < paths.size(); i++) {
+            if(const auto* entry = cache.find(paths[i])) {
+                units[i] = cache.to_unit(*entry);
+            }
+        }
+    }));
+
+    // End to end with a warm cache, what every invocation of vhdlmake pays
+    phases.emplace_back("warm_graph", measure(config.rounds, [&] {
+        vm::DependencyGraph warm;
+    }));
+
+    size_t bytes = 0;
+    for(const auto& path : paths) {
+        bytes += fs::file_size(path);
+    }
+
+    fs::current_path(previous);
+    fs::remove_all(directory);
+
+    std::cout << "{\"files\": " << paths.size()
+              << ", \"bytes\": " << bytes
+              << ", \"fan_out\": " << config.fan_out
+              << ", \"fan_in\": " << config.fan_in
+              << ", \"depth\": " << config.depth
+              << ", \"changed\": " << selection.size()
+              << ", \"partial_dag\": " << update_count
+              << ", \"workers\": " << workers
+              << ", \"seconds\": {";
+    for(size_t i = 0; i < phases.size(); i++) {
+        std::cout << (i ? ", " : "") << "\"" << phases[i].first << "\": " << phases[i].second;
+    }
+    std::cout << "}}" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    Config config;
+    for(int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        std::string value = argv[i + 1];
+
+        if(arg == "--files") {
+            config.files.clear();
+            std::stringstream list(value);
+            for(std::string item; std::getline(list, item, ',');) {
+                config.files.push_back(std::stoul(item));
+            }
+        } else if(arg == "--fan-out") {
+            config.fan_out = std::stoul(value);
+        } else if(arg == "--fan-in") {
+            config.fan_in = std::stoul(value);
+        } else if(arg == "--depth") {
+            config.depth = std::max<size_t>(1, std::stoul(value));
+        } else if(arg == "--size") {
+            config.size = std::stoul(value);
+        } else if(arg == "--changed") {
+            config.changed = std::stod(value);
+        } else if(arg == "--rounds") {
+            config.rounds = std::max(1, std::stoi(value));
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    for(size_t files : config.files) {
+        run(files, config);
+    }
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include "ArtifactStore.hpp"
+#include "Constants.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace vm {
+    static constexpr const char* C_BLOCK_FILE = "block";
+    static constexpr const char* C_OBJECT_FILE = "object.o";
+
+    static std::string default_root() {
+        const char* xdg = std::getenv("XDG_CACHE_HOME");
+        if(xdg != nullptr && xdg[0] != '\0') {
+            return (fs::path(xdg) / C_STORE_DIRECTORY).string();
+        }
+
+        const char* home = std::getenv("HOME");
+        if(home != nullptr && home[0] != '\0') {
+            return (fs::path(home) / ".cache" / C_STORE_DIRECTORY).string();
+        }
+
+        return "";
+    }
+
+    ArtifactStore::ArtifactStore() : root(default_root()) { }
+
+    ArtifactStore::ArtifactStore(const std::string& root) : root(root) { }
+
+    std::string ArtifactStore::entry_path(uint64_t key) const {
+        char name[17];
+        std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+
+        // Fanned out by the first byte, so no directory gets too big
+        return (fs::path(root) / std::string(name, 2) / name).string();
+    }
+
+    bool ArtifactStore::restore(uint64_t key, std::string& block, const std::string& object) const {
+        if(!is_open()) {
+            return false;
+        }
+
+        fs::path entry = entry_path(key);
+        std::ifstream file(entry / C_BLOCK_FILE);
+        if(!file.is_open()) {
+            return false;
+        }
+
+        std::stringstream content;
+        content << file.rdbuf();
+        block = content.str();
+
+        std::error_code error;
+        if(fs::exists(entry / C_OBJECT_FILE, error)) {
+            fs::copy_file(entry / C_OBJECT_FILE, object, fs::copy_options::overwrite_existing, error);
+            if(error) {
+                return false;
+            }
+        }
+
+        return !block.empty();
+    }
+
+    bool ArtifactStore::store(uint64_t key, const std::string& block, const std::string& object) const {
+        if(!is_open() || block.empty()) {
+            return false;
+        }
+
+        fs::path entry = entry_path(key);
+        std::error_code error;
+        if(fs::exists(entry, error)) {
+            return true;
+        }
+
+        // Filled in a private directory and renamed into place, so readers never see half an entry
+        fs::path tmp = fs::path(root) / ("tmp-" + std::to_string(getpid()) + "-" + entry.filename().string());
+        fs::remove_all(tmp, error);
+        fs::create_directories(tmp, error);
+        if(error) {
+            return false;
+        }
+
+        {
+            std::ofstream file(tmp / C_BLOCK_FILE, std::ios::trunc);
+            file << block;
+            if(!file.good()) {
+                fs::remove_all(tmp, error);
+                return false;
+            }
+        }
+
+        if(fs::exists(object, error)) {
+            fs::copy_file(object, tmp / C_OBJECT_FILE, error);
+        }
+
+        fs::create_directories(entry.parent_path(), error);
+        fs::rename(tmp, entry, error);
+        if(error) {
+            // Most likely another build stored the same entry in the meantime
+            fs::remove_all(tmp, error);
+        }
+        return true;
+    }
+} // namespace vm
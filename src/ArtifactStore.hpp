@@ -0,0 +1,34 @@
+#ifndef ARTIFACT_STORE_HPP
+#define ARTIFACT_STORE_HPP
+
+#include <string>
+#include <cstdint>
+
+namespace vm {
+    // Content addressed store of analysis results in one directory for all projects
+    // of a user. An entry holds the library index block of a design file and its
+    // object file, if the backend writes one. Entries are never changed once
+    // written, so concurrent builds can share the store without locking.
+    class ArtifactStore {
+    public:
+        // Uses $XDG_CACHE_HOME/vhdlmake or ~/.cache/vhdlmake
+        ArtifactStore();
+        explicit ArtifactStore(const std::string& root);
+
+        bool is_open() const { return !root.empty(); }
+
+        // Fetches the index block of an entry and copies its object file to
+        // `object`. Returns false if there is no entry for the key.
+        bool restore(uint64_t key, std::string& block, const std::string& object) const;
+
+        // Adds an entry, `object` is only stored if it exists
+        bool store(uint64_t key, const std::string& block, const std::string& object) const;
+
+    private:
+        std::string entry_path(uint64_t key) const;
+
+        std::string root;
+    };
+} // namespace vm
+
+#endif
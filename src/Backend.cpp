@@ -0,0 +1,237 @@
+#include "Backend.hpp"
+#include "Constants.hpp"
+#include "Hash.hpp"
+#include "Scanner.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+namespace vm {
+    static void hash_strings(Hasher& hasher, const std::vector<std::string>& strings) {
+        for(const auto& s : strings) {
+            hasher.update(std::string_view(s.c_str(), s.size() + 1));
+        }
+        hasher.update(std::string_view("\n", 1));
+    }
+
+    bool Backend::preset(const std::string& name, Backend& backend) {
+        if(name == "ghdl") {
+            backend = Backend {};
+            return true;
+        }
+
+        // NVC keeps every unit in a file of its own, a private copy of the
+        // library per job like for GHDL doesn't work there
+        if(name == "nvc") {
+            backend = Backend { .tool = Tool::NVC, .executable = "nvc", .parallel = false };
+            return true;
+        }
+
+        return false;
+    }
+
+    bool Backend::load(const std::string& path, Backend& backend) {
+        std::ifstream file(path);
+        if(!file.is_open()) {
+            return true;
+        }
+
+        json config = json::parse(file, nullptr, false, true);
+        if(config.is_discarded() || !config.is_object()) {
+            std::cerr << "[ERROR] " << path << " is not a valid JSON object" << std::endl;
+            return false;
+        }
+
+        // Everything else is relative to the preset of the tool
+        std::string tool = config.value("tool", "ghdl");
+        if(!preset(tool, backend)) {
+            std::cerr << "[ERROR] Unknown tool '" << tool << "' in " << path << ", use ghdl or nvc" << std::endl;
+            return false;
+        }
+
+        auto strings = [&](const char* key, std::vector<std::string>& target) {
+            if(!config.contains(key)) {
+                return true;
+            }
+            if(!config[key].is_array() || !std::all_of(config[key].begin(), config[key].end(), [](const json& v) { return v.is_string(); })) {
+                std::cerr << "[ERROR] " << key << " in " << path << " has to be a list of strings" << std::endl;
+                return false;
+            }
+            target = config[key].get<std::vector<std::string>>();
+            return true;
+        };
+
+        auto value = [&]<typename T>(const char* key, T& target) {
+            if(!config.contains(key)) {
+                return true;
+            }
+
+            try {
+                target = config[key].get<T>();
+            } catch(const json::exception&) {
+                std::cerr << "[ERROR] " << key << " in " << path << " has the wrong type" << std::endl;
+                return false;
+            }
+            return true;
+        };
+
+        if(!value("executable", backend.executable) || !value("std", backend.standard) || !value("workdir", backend.workdir)
+                || !value("batch", backend.batch) || !value("parallel", backend.parallel)
+                || !strings("flags", backend.flags) || !strings("elaborate_flags", backend.elaborate_flags)
+                || !strings("run_flags", backend.run_flags)) {
+            return false;
+        }
+
+        // clean deletes NVC's library directory, it must not be the project or hold sources
+        if(backend.workdir != "") {
+            fs::path workdir = fs::path(backend.workdir).lexically_normal();
+            bool outside = workdir.is_absolute() || workdir == "." || workdir == "./"
+                || std::any_of(workdir.begin(), workdir.end(), [](const fs::path& part) { return part == ".."; });
+            if(outside) {
+                std::cerr << "[ERROR] workdir in " << path << " has to be a directory below the project" << std::endl;
+                return false;
+            }
+
+            std::error_code error;
+            for(auto it = fs::recursive_directory_iterator(workdir, fs::directory_options::skip_permission_denied, error);
+                    it != fs::recursive_directory_iterator(); it.increment(error)) {
+                if(error) {
+                    break;
+                }
+                if(is_source_file(it->path().filename().string())) {
+                    std::cerr << "[ERROR] workdir " << backend.workdir << " in " << path << " contains sources like "
+                              << it->path().string() << std::endl;
+                    return false;
+                }
+            }
+        }
+
+        // NVC doesn't support VHDL-87
+        const std::string& std = backend.standard;
+        const bool ghdl = backend.tool == Tool::GHDL;
+        if((std != "87" || !ghdl) && std != "93" && std != "02" && std != "08" && std != "19") {
+            std::cerr << "[ERROR] Unknown VHDL standard '" << std << "' in " << path << ", use "
+                      << (ghdl ? "87, " : "") << "93, 02, 08 or 19" << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    std::vector<std::string> Backend::cmd_analyse(const std::vector<std::string>& files, const std::string& workdir) const {
+        const std::string& library = workdir != "" ? workdir : this->workdir;
+        std::vector<std::string> command { executable };
+
+        if(tool == Tool::NVC) {
+            command.push_back("--std=" + standard);
+            if(library != "") {
+                command.push_back("--work=" + library);
+            }
+            command.push_back("-a");
+        } else {
+            command.push_back("-a");
+            command.push_back("--std=" + standard);
+            if(library != "") {
+                command.push_back("--workdir=" + library);
+            }
+        }
+
+        command.insert(command.end(), flags.begin(), flags.end());
+        command.insert(command.end(), files.begin(), files.end());
+        return command;
+    }
+
+    std::vector<std::string> Backend::cmd_elaborate(const std::string& entity) const {
+        std::vector<std::string> command { executable };
+
+        if(tool == Tool::NVC) {
+            command.push_back("--std=" + standard);
+            if(workdir != "") {
+                command.push_back("--work=" + workdir);
+            }
+            command.push_back("-e");
+        } else {
+            // GHDL wants the analysis options again, like -frelaxed or -fsynopsys
+            command.push_back("-e");
+            command.push_back("--std=" + standard);
+            if(workdir != "") {
+                command.push_back("--workdir=" + workdir);
+            }
+            command.insert(command.end(), flags.begin(), flags.end());
+        }
+
+        command.insert(command.end(), elaborate_flags.begin(), elaborate_flags.end());
+        command.push_back(entity);
+        return command;
+    }
+
+    std::vector<std::string> Backend::cmd_run(const std::string& entity, const std::string& wave) const {
+        std::vector<std::string> command { executable };
+
+        if(tool == Tool::NVC) {
+            command.push_back("--std=" + standard);
+            if(workdir != "") {
+                command.push_back("--work=" + workdir);
+            }
+            command.push_back("-r");
+            command.push_back("--wave=" + wave);
+            command.insert(command.end(), run_flags.begin(), run_flags.end());
+            command.push_back(entity);
+            return command;
+        }
+
+        command.push_back("-r");
+        command.push_back("--std=" + standard);
+        if(workdir != "") {
+            command.push_back("--workdir=" + workdir);
+        }
+        command.insert(command.end(), flags.begin(), flags.end());
+        command.push_back(entity);
+        command.insert(command.end(), run_flags.begin(), run_flags.end());
+        command.push_back("--wave=" + wave);
+        return command;
+    }
+
+    std::string Backend::library_directory() const {
+        if(workdir != "") {
+            return workdir;
+        }
+        return tool == Tool::NVC ? "work" : ".";
+    }
+
+    std::string Backend::library_index() const {
+        if(tool != Tool::GHDL) {
+            return "";
+        }
+
+        // VHDL-2002 designs share the library of VHDL-93
+        return "work-obj" + (standard == "02" ? std::string("93") : standard) + ".cf";
+    }
+
+    const char* Backend::wave_extension() const {
+        return tool == Tool::NVC ? ".fst" : ".ghw";
+    }
+
+    uint64_t Backend::analysis_hash() const {
+        Hasher hasher;
+        hasher.update(tool == Tool::NVC ? "nvc" : "ghdl");
+        hash_strings(hasher, { executable, standard, workdir });
+        hash_strings(hasher, flags);
+        return hasher.digest();
+    }
+
+    uint64_t Backend::elaboration_hash() const {
+        Hasher hasher;
+        uint64_t analysis = analysis_hash();
+        hasher.update(std::string_view(reinterpret_cast<const char*>(&analysis), sizeof(analysis)));
+        hash_strings(hasher, elaborate_flags);
+        return hasher.digest();
+    }
+} // namespace vm
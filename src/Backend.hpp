@@ -0,0 +1,67 @@
+#ifndef BACKEND_HPP
+#define BACKEND_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace vm {
+    // The simulator that analyses, elaborates and runs the design, with the
+    // settings of the project. Without a vhdlmake.json it is GHDL with VHDL-2008.
+    //
+    //   {
+    //     "tool": "nvc",              ghdl or nvc
+    //     "executable": "nvc",        defaults to the name of the tool
+    //     "std": "08",                93, 02, 08 or 19
+    //     "flags": ["--relaxed"],     analysis options, GHDL also gets them when elaborating
+    //     "elaborate_flags": [],
+    //     "run_flags": [],
+    //     "workdir": "build",         where the work library lives, below the project and without sources
+    //     "batch": true,              may analyse several files with one call
+    //     "parallel": false           may analyse several files at the same time
+    //   }
+    struct Backend {
+        enum class Tool : uint8_t {
+            GHDL = 0,
+            NVC
+        };
+
+        Tool tool = Tool::GHDL;
+        std::string executable = "ghdl";
+        std::string standard = "08";
+        std::vector<std::string> flags;
+        std::vector<std::string> elaborate_flags;
+        std::vector<std::string> run_flags;
+        std::string workdir;
+        bool batch = true;
+        bool parallel = true;
+
+        // Defaults for a tool name, false if the tool is unknown
+        static bool preset(const std::string& name, Backend& backend);
+
+        // Reads a project configuration, a missing file keeps the defaults
+        static bool load(const std::string& path, Backend& backend);
+
+        // `workdir` replaces the configured one, for jobs with a private library
+        std::vector<std::string> cmd_analyse(const std::vector<std::string>& files, const std::string& workdir = "") const;
+        std::vector<std::string> cmd_elaborate(const std::string& entity) const;
+        std::vector<std::string> cmd_run(const std::string& entity, const std::string& wave) const;
+
+        // Directory of the work library, "." for the working directory
+        std::string library_directory() const;
+
+        // Name of GHDL's library index in the library directory, empty for NVC
+        std::string library_index() const;
+
+        // Extension of the waveform files the simulator writes
+        const char* wave_extension() const;
+
+        // Over everything that changes the result of an analysis
+        uint64_t analysis_hash() const;
+
+        // Over everything that changes the result of an elaboration, includes the analysis
+        uint64_t elaboration_hash() const;
+    };
+} // namespace vm
+
+#endif
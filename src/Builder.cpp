@@ -1,69 +1,382 @@
 #include "Builder.hpp"
 #include "DependencyGraph.hpp"
 #include "Constants.hpp"
+#include "WorkLibrary.hpp"
+#include "Trace.hpp"
+#include "Executor.hpp"
+#include "Hash.hpp"
+#include "Journal.hpp"
+#include "Utility.hpp"
 
 #include <filesystem>
 #include <iostream>
-
+#include <optional>
+#include <queue>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cctype>
 
 
 namespace fs = std::filesystem;
 
 namespace vm {
-    static int execute_command(const std::string& command) {
-        int ret = system(command.c_str());
-        if(!WIFEXITED(ret)) {
-            return 1;
-        } else {
-            return WEXITSTATUS(ret);
+    static uint32_t elapsed_us(std::chrono::steady_clock::time_point start) {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    }
+
+    // Steps on the critical path go first, the plan order breaks ties
+    struct ByPriority {
+        const BuildPlan* plan;
+
+        bool operator()(size_t a, size_t b) const {
+            const auto& x = (*plan)[a];
+            const auto& y = (*plan)[b];
+            return x.priority != y.priority ? x.priority < y.priority : a > b;
+        }
+    };
+
+    using ReadyQueue = std::priority_queue<size_t, std::vector<size_t>, ByPriority>;
+
+    // Joins a command for the shell, ninja variables like $in stay unquoted
+    static std::string command_line(const std::vector<std::string>& args) {
+        std::string line;
+        for(const auto& arg : args) {
+            bool plain = !arg.empty() && std::all_of(arg.begin(), arg.end(), [](char c) {
+                return std::isalnum(static_cast<unsigned char>(c)) || std::string_view("_-+=./,:${}").find(c) != std::string_view::npos;
+            });
+
+            line += line.empty() ? "" : " ";
+            line += plain ? arg : shell_quote(arg);
         }
+        return line;
     }
 
-    Builder::Builder() {
+    static std::string format_seconds(double seconds) {
+        char text[32];
+        std::snprintf(text, sizeof(text), "%.2f s", seconds);
+        return text;
+    }
+
+    Builder::Builder(const Options& options)
+            : backend(options.backend), jobs(std::max(options.jobs, 1)), timeout(options.timeout), use_store(options.store) {
+        // A backend that can't analyse several files with one call gets them one by one
+        batch = backend.batch ? std::max(options.batch, 1) : 1;
+
         if(!fs::exists(C_VCD_DIRECTORY)) {
             fs::create_directory(C_VCD_DIRECTORY);
         }
+
+        // GHDL doesn't create its work directory, NVC does
+        if(backend.tool == Backend::Tool::GHDL && !fs::exists(backend.library_directory())) {
+            fs::create_directories(backend.library_directory());
+        }
+    }
+
+    // Where the gcc and llvm backends of GHDL put the object file of a design file
+    std::string Builder::object_file(const std::string& path) const {
+        return (fs::path(backend.library_directory()) / (fs::path(path).stem().string() + ".o")).string();
+    }
+
+    std::vector<std::string> Builder::cmd_compile(const std::vector<std::string>& files, const std::string& workdir) {
+        return backend.cmd_analyse(files, workdir);
+    }
+
+    std::vector<std::string> Builder::cmd_link(const std::string& entity) {
+        return backend.cmd_elaborate(entity);
+    }
+
+    std::vector<std::string> Builder::cmd_run(const std::string& entity) {
+        return backend.cmd_run(entity, std::string(C_VCD_DIRECTORY) + "/" + entity + backend.wave_extension());
     }
 
-    std::string Builder::cmd_compile(const std::string& file) {
-        std::stringstream stream;
-        stream << "ghdl -a --std=08 " << file;
-        return stream.str();
+    uint64_t Builder::artifact_key(const BuildStep& step) {
+        // Index blocks name their design file by the directory GHDL ran in, so a
+        // block only fits checkouts at the same place
+        uint64_t flags = backend.analysis_hash();
+        std::string project = fs::current_path().string();
+        Hasher hasher;
+        hasher.update(std::string_view(reinterpret_cast<const char*>(&step.key), sizeof(step.key)));
+        hasher.update(std::string_view(reinterpret_cast<const char*>(&flags), sizeof(flags)));
+        hasher.update(project);
+        return hasher.digest();
     }
 
-    std::string Builder::cmd_link(const std::string& entity) {
-        std::stringstream stream;
-        stream << " ghdl -e --std=08 " << entity;
-        return stream.str();
+    bool Builder::uses_store() const {
+        // NVC keeps every unit in files of its own instead of a single index
+        return use_store && backend.tool == Backend::Tool::GHDL && artifacts.is_open();
     }
 
-    std::string Builder::cmd_run(const std::string& entity) {
-        std::stringstream stream;
-        stream << "ghdl -r --std=08 " << entity << " --wave=" << C_VCD_DIRECTORY << "/" << entity << ".ghw";
-        return stream.str();
+    size_t Builder::restore(const BuildPlan& plan, std::vector<uint8_t>& restored) {
+        if(!uses_store()) {
+            return 0;
+        }
+        Trace::Scope scope("restore");
+
+        // A file that is analysed now gets a newer time stamp than the stored
+        // results of the files depending on it, so those are analysed as well.
+        // The plan is in topological order, predecessors are decided first.
+        std::vector<uint8_t> blocked(plan.size(), 0);
+        std::vector<std::string> indexes;
+        for(size_t i = 0; i < plan.size(); i++) {
+            const BuildStep& step = plan[i];
+            std::string index;
+            if(!blocked[i] && step.key != 0 && artifacts.restore(artifact_key(step), index, object_file(step.path))) {
+                restored[i] = 1;
+                indexes.push_back(std::move(index));
+                continue;
+            }
+
+            for(size_t dep : step.dependants) {
+                blocked[dep] = 1;
+            }
+        }
+
+        // All entries go into the library with a single write, before any job reads it
+        if(indexes.empty() || !WorkLibrary::merge(backend.library_directory(), indexes, backend.library_index())) {
+            std::fill(restored.begin(), restored.end(), 0);
+            return 0;
+        }
+
+        for(size_t i = 0; i < plan.size(); i++) {
+            if(restored[i]) {
+                std::cerr << "[RESTORE] " << plan[i].path << std::endl;
+            }
+        }
+
+        Trace::count(Trace::ARTIFACTS_RESTORED, indexes.size());
+        return indexes.size();
+    }
+
+    void Builder::store(const BuildPlan& plan, const std::vector<uint8_t>& analysed) {
+        if(!uses_store()) {
+            return;
+        }
+
+        std::vector<std::string> files;
+        for(size_t i = 0; i < plan.size(); i++) {
+            if(analysed[i] && plan[i].key != 0) {
+                files.push_back(plan[i].path);
+            }
+        }
+        if(files.empty()) {
+            return;
+        }
+        Trace::Scope scope("store");
+
+        size_t stored = 0;
+        std::unordered_map<std::string, std::string> indexes = WorkLibrary::extract(backend.library_directory(), files, backend.library_index());
+        for(size_t i = 0; i < plan.size(); i++) {
+            auto it = indexes.find(plan[i].path);
+            if(analysed[i] && it != indexes.end() && artifacts.store(artifact_key(plan[i]), it->second, object_file(plan[i].path))) {
+                stored++;
+            }
+        }
+
+        Trace::count(Trace::ARTIFACTS_STORED, stored);
+    }
+
+    // Journal record of a step that is in the library now
+    static Journal::Record done_record(const BuildStep& step) {
+        return Journal::Record { .path = step.path, .done = true, .hash = step.hash, .duration = step.duration };
+    }
+
+    int Builder::analyse(BuildPlan& plan) {
+        std::vector<uint8_t> restored(plan.size(), 0);
+        const size_t pending = plan.size() - restore(plan, restored);
+
+        // Progress is recorded as it happens, so a failed build can be resumed
+        std::optional<Journal> journal;
+        if(!plan.empty()) {
+            journal.emplace(std::string(C_JOURNAL_FILE));
+
+            std::vector<std::string> paths;
+            std::vector<Journal::Record> records;
+            for(size_t i = 0; i < plan.size(); i++) {
+                plan[i].done = restored[i];
+                if(restored[i]) {
+                    records.push_back(done_record(plan[i]));
+                } else {
+                    paths.push_back(plan[i].path);
+                }
+            }
+            journal->pending(paths);
+            journal->done(records);
+        }
+
+        // A single job analyses directly into the shared library
+        const bool parallel = backend.parallel && jobs > 1 && pending > 1;
+        const size_t workers = backend.parallel ? jobs : 1;
+        std::optional<WorkLibrary> library;
+        if(parallel) {
+            library.emplace(backend.library_directory(), backend.library_index());
+        }
+
+        struct Job {
+            std::vector<size_t> steps;
+            size_t slot;
+            std::chrono::steady_clock::time_point start;
+        };
+
+        Executor executor;
+        std::unordered_map<Executor::JobId, Job> running;
+        std::vector<size_t> slots;
+        for(size_t slot = std::min<size_t>(workers, pending); slot > 0; slot--) {
+            slots.push_back(slot - 1);
+        }
+
+        ReadyQueue ready(ByPriority { &plan });
+        std::vector<int> in(plan.size());
+
+        // Files of failed batches, analysed one by one even after a failure, because
+        // they were started before it. Taken from the back.
+        std::vector<size_t> retry;
+        std::vector<uint8_t> analysed(plan.size(), 0);
+        int result = 0;
+
+        // Restored steps count as analysed, their dependants always come later in the plan
+        for(size_t i = 0; i < plan.size(); i++) {
+            in[i] += plan[i].in;
+            if(restored[i]) {
+                for(size_t dep : plan[i].dependants) {
+                    in[dep]--;
+                }
+            }
+        }
+
+        for(size_t i = 0; i < plan.size(); i++) {
+            if(!restored[i] && in[i] == 0) {
+                ready.push(i);
+            }
+        }
+
+        // Ready-queue scheduler: a step is started as soon as all of its
+        // predecessors are analysed. After the first failure no new steps are
+        // started, but the ones already running are allowed to finish.
+        while(true) {
+            while(!slots.empty() && (!retry.empty() || (result == 0 && !ready.empty()))) {
+                std::vector<size_t> steps;
+                if(!retry.empty()) {
+                    steps.push_back(retry.back());
+                    retry.pop_back();
+                } else {
+                    steps.push_back(ready.top());
+                    ready.pop();
+
+                    // Share the ready steps with the free slots instead of batching them all
+                    size_t take = std::clamp<size_t>((ready.size() + 1) / slots.size(), 1, batch);
+                    while(steps.size() < take && !ready.empty()) {
+                        steps.push_back(ready.top());
+                        ready.pop();
+                    }
+                }
+
+                std::vector<std::string> files;
+                for(size_t step : steps) {
+                    std::cerr << "[COMPILE] " << plan[step].path << std::endl;
+                    files.push_back(plan[step].path);
+                }
+
+                size_t slot = slots.back();
+                slots.pop_back();
+                std::string workdir = parallel ? library->checkout(slot) : "";
+                Executor::JobId id = executor.start(cmd_compile(files, workdir));
+                running.emplace(id, Job { std::move(steps), slot, std::chrono::steady_clock::now() });
+            }
+
+            if(running.empty()) {
+                break;
+            }
+
+            for(auto& done : executor.wait()) {
+                Job job = std::move(running.at(done.id));
+                running.erase(done.id);
+                slots.push_back(job.slot);
+
+                const std::string& first = plan[job.steps[0]].path;
+                std::string name = job.steps.size() == 1 ? first : first + " (+" + std::to_string(job.steps.size() - 1) + ")";
+                Trace::record(name, "analyse", job.start, job.slot);
+
+                // The share of every file in a batch is unknown, so all get the same
+                uint32_t duration = std::max<uint32_t>(1, elapsed_us(job.start) / job.steps.size());
+                for(size_t step : job.steps) {
+                    plan[step].duration = duration;
+                }
+
+                int ret = done.status;
+                if(ret == 0 && parallel && !library->commit(job.slot)) {
+                    ret = 1;
+                }
+
+                // GHDL stops at the first broken file, analyse the batch again one
+                // by one to find it. Files before it are just analysed a second time.
+                // Its messages come again from that file alone, with the right name.
+                if(ret != 0 && job.steps.size() > 1) {
+                    std::cerr << "[WARN] Batch of " << job.steps.size() << " files failed, analysing them one by one" << std::endl;
+                    retry.insert(retry.end(), job.steps.rbegin(), job.steps.rend());
+                    continue;
+                }
+
+                std::cerr << done.output;
+
+                if(ret != 0) {
+                    if(result == 0) {
+                        result = ret;
+                        std::cerr << "[ERROR] " << first << " failed";
+                        if(!running.empty()) {
+                            std::cerr << ", waiting for running jobs";
+                        }
+                        std::cerr << std::endl;
+                    }
+                    continue;
+                }
+
+                std::vector<Journal::Record> records;
+                for(size_t step : job.steps) {
+                    analysed[step] = 1;
+                    plan[step].done = true;
+                    records.push_back(done_record(plan[step]));
+                }
+                journal->done(records);
+
+                for(size_t step : job.steps) {
+                    for(size_t dep : plan[step].dependants) {
+                        if(--in[dep] == 0) {
+                            ready.push(dep);
+                        }
+                    }
+                }
+            }
+        }
+
+        store(plan, analysed);
+        return result;
     }
 
-    int Builder::build(const std::string& entity, const std::vector<std::string> update_list) {
+    int Builder::build(const std::string& entity, BuildPlan& plan, bool elaborated) {
         // No need to build if no files were changed
-        if(update_list.empty()) {
+        if(plan.empty()) {
             std::cerr << "[INFO] No changes" << std::endl;
         }
 
         // Analyze all files
-        for(const auto& unit : update_list) {
-            std::cerr << "[COMPILE] " << unit << std::endl;
-            auto command = cmd_compile(unit);
-            int ret = execute_command(command);
-            if(ret) {
-                return ret;
-            }
+        int ret = 0;
+        {
+            Trace::Scope scope("build");
+            ret = analyse(plan);
+        }
+        if(ret) {
+            return ret;
         }
 
         // Link final entity if needed 
-        if(entity != "") {
+        if(entity != "" && elaborated) {
+            std::cerr << "[INFO] " << entity << " is up to date" << std::endl;
+        } else if(entity != "") {
             std::cerr << "[LINK] " << entity << std::endl;
-            auto command = cmd_link(entity);
-            int ret = execute_command(command);
+            Trace::Scope scope(entity, "elaborate");
+            ret = Executor::run(cmd_link(entity));
             if(ret) {
                 return ret;
             }
@@ -74,8 +387,132 @@ namespace vm {
 
     int Builder::run(const std::string& entity) {
         std::cerr << "[RUN] " << entity << std::endl;
-        auto command = cmd_run(entity);
-        return execute_command(command);
+        Trace::Scope scope(entity, "run");
+
+        // Simulations may run for a long time, so their output isn't held back
+        return Executor::run(cmd_run(entity), false);
+    }
+
+    int Builder::test(std::vector<TestResult>& tests) {
+        using Clock = std::chrono::steady_clock;
+        const auto limit = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(timeout));
+
+        // A test is elaborated first, unless its binary is up to date, and then simulated.
+        // The timeout only applies to the simulation.
+        struct Job {
+            size_t test;
+            size_t slot;
+            bool simulating;
+            bool stopped;
+            Clock::time_point start;
+            Clock::time_point simulation_start;
+        };
+
+        Executor executor;
+        std::unordered_map<Executor::JobId, Job> running;
+        std::vector<size_t> slots;
+        for(size_t slot = std::min<size_t>(jobs, tests.size()); slot > 0; slot--) {
+            slots.push_back(slot - 1);
+        }
+
+        size_t next = 0;
+        size_t failed = 0;
+        auto start_stage = [&](Job job) {
+            const std::string& entity = tests[job.test].entity;
+            if(job.simulating) {
+                job.simulation_start = Clock::now();
+            }
+            Executor::JobId id = executor.start(job.simulating ? cmd_run(entity) : cmd_link(entity));
+            running.emplace(id, job);
+        };
+
+        auto finish = [&](const Job& job, TestStatus status) {
+            TestResult& test = tests[job.test];
+            test.status = status;
+            test.seconds = std::chrono::duration<double>(Clock::now() - job.start).count();
+            Trace::record(test.entity, "test", job.start, job.slot);
+            slots.push_back(job.slot);
+
+            if(status == TestStatus::PASSED) {
+                std::cerr << "[PASS] " << test.entity << " (" << format_seconds(test.seconds) << ")" << std::endl;
+                return;
+            }
+
+            failed++;
+            std::cerr << test.output;
+            std::cerr << "[" << (status == TestStatus::TIMEOUT ? "TIMEOUT" : status == TestStatus::FAILED ? "FAIL" : "ERROR")
+                      << "] " << test.entity << " (" << format_seconds(test.seconds) << ")" << std::endl;
+        };
+
+        while(true) {
+            while(next < tests.size() && !slots.empty()) {
+                std::cerr << "[TEST] " << tests[next].entity << std::endl;
+                size_t slot = slots.back();
+                slots.pop_back();
+                start_stage(Job { next, slot, tests[next].elaborated, false, Clock::now(), {} });
+                next++;
+            }
+
+            if(running.empty()) {
+                break;
+            }
+
+            // Wake up for the first deadline of a running test
+            int wait_ms = -1;
+            if(timeout > 0) {
+                Clock::time_point deadline = Clock::time_point::max();
+                for(const auto& [id, job] : running) {
+                    if(job.simulating && !job.stopped) {
+                        deadline = std::min(deadline, job.simulation_start + limit);
+                    }
+                }
+
+                if(deadline != Clock::time_point::max()) {
+                    auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - Clock::now()).count();
+                    wait_ms = std::max<int64_t>(left, 0);
+                }
+            }
+
+            std::vector<Executor::Result> results = executor.wait(wait_ms);
+            for(auto& [id, job] : running) {
+                if(timeout > 0 && job.simulating && !job.stopped && Clock::now() >= job.simulation_start + limit) {
+                    executor.stop(id);
+                    job.stopped = true;
+                }
+            }
+
+            for(auto& done : results) {
+                Job job = running.at(done.id);
+                running.erase(done.id);
+
+                TestResult& test = tests[job.test];
+                test.output += done.output;
+
+                if(job.stopped) {
+                    finish(job, TestStatus::TIMEOUT);
+                } else if(done.status != 0) {
+                    finish(job, job.simulating ? TestStatus::FAILED : TestStatus::ERROR);
+                } else if(!job.simulating) {
+                    test.elaborated = true;
+                    job.simulating = true;
+                    start_stage(job);
+                } else {
+                    finish(job, TestStatus::PASSED);
+                }
+            }
+        }
+
+        std::cerr << "[INFO] " << tests.size() - failed << " of " << tests.size() << " tests passed" << std::endl;
+        return failed != 0;
+    }
+
+    NinjaRules Builder::get_ninja_rules(const std::string& regenerate) {
+        return NinjaRules {
+            .analyse = command_line(cmd_compile({ "$in" })) + " && touch $out",
+            .elaborate = command_line(cmd_link("${entity}")) + " && touch $out",
+            .run = command_line(cmd_run("${entity}")),
+            .regenerate = regenerate
+        };
     }
 
     int Builder::clean() {
@@ -94,6 +531,33 @@ namespace vm {
             std::cerr << "[DELETE] " << C_CACHE_FILE << std::endl;
         }
 
+        if(fs::exists(C_JOURNAL_FILE)) {
+            fs::remove(C_JOURNAL_FILE);
+            std::cerr << "[DELETE] " << C_JOURNAL_FILE << std::endl;
+        }
+
+        if(fs::exists(C_JOB_DIRECTORY)) {
+            fs::remove_all(C_JOB_DIRECTORY);
+            std::cerr << "[DELETE] " << C_JOB_DIRECTORY << std::endl;
+        }
+
+        // NVC's library is a directory of its own, marked by the _NVC_LIB file in it
+        const std::string library = backend.library_directory();
+        if(backend.tool == Backend::Tool::NVC && fs::exists(library)) {
+            if(fs::exists(fs::path(library) / "_NVC_LIB")) {
+                fs::remove_all(library);
+                std::cerr << "[DELETE] " << library << std::endl;
+            } else {
+                std::cerr << "[WARN] " << library << " is not an NVC library, leaving it" << std::endl;
+            }
+        }
+
+        // The stamps of a generated build.ninja describe the library that is gone now
+        if(fs::exists(C_NINJA_DIRECTORY)) {
+            fs::remove_all(C_NINJA_DIRECTORY);
+            std::cerr << "[DELETE] " << C_NINJA_DIRECTORY << std::endl;
+        }
+
         std::cerr << "[INFO] Cleaned" << std::endl;
 
         return 0;
@@ -1,20 +1,62 @@
+#ifndef BUILDER_HPP
+#define BUILDER_HPP
+
+#include "DependencyGraph.hpp"
+#include "Options.hpp"
+#include "ArtifactStore.hpp"
+#include "TestReport.hpp"
+
 #include <string>
 #include <vector>
 
 namespace vm {
     class Builder {
     public: 
-        Builder();
+        explicit Builder(const Options& options = {});
 
-        int build(const std::string& entity, const std::vector<std::string> update_list);
+        // Analyses all steps of the plan and stores their durations in it. The
+        // entity is elaborated afterwards, unless it is already up to date.
+        int build(const std::string& entity, BuildPlan& plan, bool elaborated = false);
         int run(const std::string& entity);
+
+        // Elaborates and simulates the testbenches, up to `jobs` at the same time,
+        // and fills in their results. Returns 0 if all of them passed.
+        int test(std::vector<TestResult>& tests);
         int clean();
 
+        // Commands for a build.ninja that does what build and run do
+        NinjaRules get_ninja_rules(const std::string& regenerate);
+
     private:
-        std::string cmd_compile(const std::string& file);
-        std::string cmd_link(const std::string& entity);
-        std::string cmd_run(const std::string& entity);
+        int analyse(BuildPlan& plan);
+
+        // Takes the results of steps whose inputs were analysed before from the
+        // store, marks them in `restored` and returns how many there were
+        size_t restore(const BuildPlan& plan, std::vector<uint8_t>& restored);
+
+        // Adds the results of the analysed steps to the store
+        void store(const BuildPlan& plan, const std::vector<uint8_t>& analysed);
+
+        // Artifact key of a step, the backend and its flags are part of it
+        uint64_t artifact_key(const BuildStep& step);
+
+        // Only GHDL's library index can be taken apart per design file
+        bool uses_store() const;
+        std::string object_file(const std::string& path) const;
+
+        std::vector<std::string> cmd_compile(const std::vector<std::string>& files, const std::string& workdir = "");
+        std::vector<std::string> cmd_link(const std::string& entity);
+        std::vector<std::string> cmd_run(const std::string& entity);
+
+        Backend backend;
+        int jobs;
+        size_t batch;
+        double timeout;
+        bool use_store;
+        ArtifactStore artifacts;
     };
 
 
-} // namespace vm
\ No newline at end of file
+} // namespace vm
+
+#endif
@@ -0,0 +1,341 @@
+#include "Cache.hpp"
+#include "Hash.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+namespace vm {
+    static constexpr char C_MAGIC[8] = { 'V', 'H', 'D', 'L', 'M', 'A', 'K', 'E' };
+
+    static_assert(sizeof(Cache::Header) == 72);
+    static_assert(sizeof(Cache::Directory) == 32);
+    static_assert(sizeof(Cache::NameRef) == 8);
+    static_assert(sizeof(Cache::Entry) == 56);
+    static_assert(sizeof(Cache::UnitEntry) == 32);
+    static_assert(sizeof(Cache::Elaborated) == 40);
+
+    Cache::Cache(const std::string& path) : file(path) {
+        Trace::Scope scope("load cache");
+        if(!file.is_open()) {
+            return;
+        }
+
+        std::string_view data = file.view();
+        const Header* header = reinterpret_cast<const Header*>(data.data());
+        if(data.size() < sizeof(Header) || std::memcmp(header->magic, C_MAGIC, sizeof(C_MAGIC)) != 0
+                || header->version != C_VERSION) {
+            outdated = true;
+            return;
+        }
+
+        // Hashes of another algorithm can't be compared, so the cache is useless
+        if(header->hash_algorithm != C_HASH_ALGORITHM) {
+            outdated = true;
+            hash_changed = true;
+            return;
+        }
+
+        size_t units_offset = sizeof(Header) + sizeof(Entry) * uint64_t(header->entry_count);
+        size_t directories_offset = units_offset + sizeof(UnitEntry) * uint64_t(header->unit_count);
+        size_t elaborated_offset = directories_offset + sizeof(Directory) * uint64_t(header->directory_count);
+        size_t names_offset = elaborated_offset + sizeof(Elaborated) * uint64_t(header->elaborated_count);
+        size_t strings_offset = names_offset + sizeof(NameRef) * uint64_t(header->name_count);
+        if(strings_offset + header->string_size != data.size()) {
+            outdated = true;
+            return;
+        }
+
+        const Entry* entry_table = reinterpret_cast<const Entry*>(data.data() + sizeof(Header));
+        const UnitEntry* unit_table = reinterpret_cast<const UnitEntry*>(data.data() + units_offset);
+        const Directory* directory_table = reinterpret_cast<const Directory*>(data.data() + directories_offset);
+        const Elaborated* elaborated_table = reinterpret_cast<const Elaborated*>(data.data() + elaborated_offset);
+        const NameRef* name_table = reinterpret_cast<const NameRef*>(data.data() + names_offset);
+
+        // Check all offsets once, so lookups don't need to
+        auto valid = [&](const NameRef& ref) {
+            return uint64_t(ref.offset) + ref.length <= header->string_size;
+        };
+
+        for(uint32_t i = 0; i < header->name_count; i++) {
+            if(!valid(name_table[i])) {
+                outdated = true;
+                return;
+            }
+        }
+
+        for(uint32_t i = 0; i < header->entry_count; i++) {
+            const Entry& entry = entry_table[i];
+            if(!valid(entry.path) || uint64_t(entry.units_begin) + entry.units_count > header->unit_count) {
+                outdated = true;
+                return;
+            }
+        }
+
+        for(uint32_t i = 0; i < header->unit_count; i++) {
+            const UnitEntry& unit = unit_table[i];
+            if(!valid(unit.name) || unit.kind > uint32_t(UnitKind::CONTEXT)
+                    || uint64_t(unit.references_begin) + unit.references_count > header->name_count) {
+                outdated = true;
+                return;
+            }
+        }
+
+        for(uint32_t i = 0; i < header->directory_count; i++) {
+            const Directory& directory = directory_table[i];
+            if(!valid(directory.path)
+                    || uint64_t(directory.files_begin) + directory.files_count > header->name_count
+                    || uint64_t(directory.directories_begin) + directory.directories_count > header->name_count) {
+                outdated = true;
+                return;
+            }
+        }
+
+        for(uint32_t i = 0; i < header->elaborated_count; i++) {
+            if(!valid(elaborated_table[i].entity)) {
+                outdated = true;
+                return;
+            }
+        }
+
+        entries = entry_table;
+        unit_entries = unit_table;
+        directories = directory_table;
+        directory_count = header->directory_count;
+        elaborated = elaborated_table;
+        elaborated_count = header->elaborated_count;
+        ignore_hash = header->ignore_hash;
+        scanned_at = header->scanned_at;
+        backend_hash = header->backend_hash;
+        names = name_table;
+        strings = data.data() + strings_offset;
+        entry_count = header->entry_count;
+    }
+
+    std::string_view Cache::string(const NameRef& ref) const {
+        return std::string_view(strings + ref.offset, ref.length);
+    }
+
+    const Cache::Entry* Cache::find(std::string_view path) const {
+        const Entry* end = entries + entry_count;
+        const Entry* it = std::lower_bound(entries, end, path, [&](const Entry& entry, std::string_view p) {
+            return string(entry.path) < p;
+        });
+
+        if(it == end || string(it->path) != path) {
+            return nullptr;
+        }
+        return it;
+    }
+
+    FileStat Cache::stat(const Entry& entry) const {
+        return FileStat {
+            .mtime = entry.mtime,
+            .size = entry.size,
+            .inode = entry.inode
+        };
+    }
+
+    DirectorySnapshot Cache::get_snapshot() const {
+        DirectorySnapshot snapshot { .scanned_at = scanned_at, .ignore_hash = ignore_hash };
+        snapshot.directories.reserve(directory_count);
+
+        for(size_t i = 0; i < directory_count; i++) {
+            const Directory& directory = directories[i];
+            ScannedDirectory& scanned = snapshot.directories.emplace_back(ScannedDirectory {
+                .path = std::string(string(directory.path)),
+                .mtime = directory.mtime
+            });
+
+            for(uint32_t n = 0; n < directory.files_count; n++) {
+                scanned.files.emplace_back(string(names[directory.files_begin + n]));
+            }
+            for(uint32_t n = 0; n < directory.directories_count; n++) {
+                scanned.directories.emplace_back(string(names[directory.directories_begin + n]));
+            }
+        }
+
+        return snapshot;
+    }
+
+    std::vector<Unit> Cache::get_units() const {
+        std::vector<Unit> units;
+        units.reserve(entry_count);
+        for(size_t i = 0; i < entry_count; i++) {
+            units.push_back(to_unit(entries[i]));
+        }
+        return units;
+    }
+
+    std::vector<Elaboration> Cache::get_elaborations() const {
+        std::vector<Elaboration> result;
+        for(size_t i = 0; i < elaborated_count; i++) {
+            result.push_back(Elaboration {
+                .entity = std::string(string(elaborated[i].entity)),
+                .fingerprint = elaborated[i].fingerprint,
+                .binary = { .mtime = elaborated[i].mtime, .size = elaborated[i].size, .inode = elaborated[i].inode }
+            });
+        }
+        return result;
+    }
+
+    Unit Cache::to_unit(const Entry& entry) const {
+        Unit unit {
+            .path = std::string(string(entry.path)),
+            .hash = entry.hash,
+            .stat = stat(entry),
+            .duration = entry.duration,
+            .pending = (entry.flags & C_PENDING) != 0
+        };
+
+        for(uint32_t i = 0; i < entry.units_count; i++) {
+            const UnitEntry& unit_entry = unit_entries[entry.units_begin + i];
+            DesignUnit& design_unit = unit.design_units.emplace_back(DesignUnit {
+                .kind = static_cast<UnitKind>(unit_entry.kind),
+                .name = std::string(string(unit_entry.name)),
+                .hash = unit_entry.hash,
+                .ports = (unit_entry.flags & C_PORTS) != 0
+            });
+
+            for(uint32_t n = 0; n < unit_entry.references_count; n++) {
+                design_unit.references.emplace(string(names[unit_entry.references_begin + n]));
+            }
+        }
+
+        unit.summarize();
+        return unit;
+    }
+
+    bool Cache::save(const std::string& path, std::vector<const Unit*> units, const DirectorySnapshot& snapshot,
+                     const std::vector<Elaboration>& elaborations, uint64_t backend_hash) {
+        Trace::Scope scope("save cache");
+        std::sort(units.begin(), units.end(), [](const Unit* a, const Unit* b) {
+            return a->path < b->path;
+        });
+
+        // Identifiers are shared between many files, so every string is only stored once
+        std::string blob;
+        std::unordered_map<std::string_view, NameRef> interned;
+        auto intern = [&](const std::string& s) {
+            auto it = interned.find(s);
+            if(it != interned.end()) {
+                return it->second;
+            }
+
+            NameRef ref { uint32_t(blob.size()), uint32_t(s.size()) };
+            blob += s;
+            interned.emplace(s, ref);
+            return ref;
+        };
+
+        std::vector<Entry> entries;
+        std::vector<UnitEntry> unit_entries;
+        std::vector<NameRef> names;
+        for(const Unit* unit : units) {
+            entries.push_back(Entry {
+                .path = intern(unit->path),
+                .hash = unit->hash,
+                .mtime = unit->stat.mtime,
+                .size = unit->stat.size,
+                .inode = unit->stat.inode,
+                .units_begin = uint32_t(unit_entries.size()),
+                .units_count = uint32_t(unit->design_units.size()),
+                .duration = unit->duration,
+                .flags = unit->pending ? C_PENDING : 0
+            });
+
+            for(const auto& design_unit : unit->design_units) {
+                unit_entries.push_back(UnitEntry {
+                    .name = intern(design_unit.name),
+                    .hash = design_unit.hash,
+                    .kind = uint32_t(design_unit.kind),
+                    .references_begin = uint32_t(names.size()),
+                    .references_count = uint32_t(design_unit.references.size()),
+                    .flags = design_unit.ports ? C_PORTS : 0
+                });
+
+                for(const auto& reference : design_unit.references) {
+                    names.push_back(intern(reference));
+                }
+            }
+        }
+
+        std::vector<Directory> directories;
+        for(const auto& scanned : snapshot.directories) {
+            Directory directory {
+                .path = intern(scanned.path),
+                .mtime = scanned.mtime,
+                .files_begin = uint32_t(names.size()),
+                .files_count = uint32_t(scanned.files.size())
+            };
+
+            for(const auto& file : scanned.files) {
+                names.push_back(intern(file));
+            }
+
+            directory.directories_begin = uint32_t(names.size());
+            directory.directories_count = uint32_t(scanned.directories.size());
+            for(const auto& child : scanned.directories) {
+                names.push_back(intern(child));
+            }
+
+            directories.push_back(directory);
+        }
+
+        std::vector<Elaborated> elaborated;
+        for(const auto& elaboration : elaborations) {
+            elaborated.push_back(Elaborated {
+                .entity = intern(elaboration.entity),
+                .fingerprint = elaboration.fingerprint,
+                .mtime = elaboration.binary.mtime,
+                .size = elaboration.binary.size,
+                .inode = elaboration.binary.inode
+            });
+        }
+
+        Header header {
+            .version = C_VERSION,
+            .entry_count = uint32_t(entries.size()),
+            .name_count = uint32_t(names.size()),
+            .hash_algorithm = C_HASH_ALGORITHM,
+            .string_size = blob.size(),
+            .directory_count = uint32_t(directories.size()),
+            .elaborated_count = uint32_t(elaborated.size()),
+            .ignore_hash = snapshot.ignore_hash,
+            .scanned_at = snapshot.scanned_at,
+            .unit_count = uint32_t(unit_entries.size()),
+            .backend_hash = backend_hash
+        };
+        std::memcpy(header.magic, C_MAGIC, sizeof(C_MAGIC));
+
+        // Write to a temporary file first, a crash must never leave half a cache behind
+        std::string tmp_path = path + ".tmp";
+        {
+            std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+            if(!file.is_open()) {
+                return false;
+            }
+
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(Entry));
+            file.write(reinterpret_cast<const char*>(unit_entries.data()), unit_entries.size() * sizeof(UnitEntry));
+            file.write(reinterpret_cast<const char*>(directories.data()), directories.size() * sizeof(Directory));
+            file.write(reinterpret_cast<const char*>(elaborated.data()), elaborated.size() * sizeof(Elaborated));
+            file.write(reinterpret_cast<const char*>(names.data()), names.size() * sizeof(NameRef));
+            file.write(blob.data(), blob.size());
+
+            if(!file.good()) {
+                return false;
+            }
+        }
+
+        std::error_code error;
+        fs::rename(tmp_path, path, error);
+        return !error;
+    }
+} // namespace vm
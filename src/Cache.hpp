@@ -0,0 +1,143 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+#include "Unit.hpp"
+#include "MappedFile.hpp"
+#include "Scanner.hpp"
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+namespace vm {
+    // Binary cache of all parsed units. The file is memory mapped and queried
+    // in place, only the entries that are actually used get turned into Units.
+    //
+    // Layout (native byte order):
+    //   Header                  includes the content hash algorithm
+    //   Entry[entry_count]      sorted by path
+    //   UnitEntry[unit_count]   design units of all entries
+    //   Directory[directory_count]  listings of the last scan, sorted by path
+    //   Elaborated[elaborated_count]  entities and the sources they were elaborated from
+    //   NameRef[name_count]     references of all design units, directory contents
+    //   char[]                  string data
+    class Cache {
+    public:
+        static constexpr uint32_t C_VERSION = 9;
+
+        // Entry flags
+        static constexpr uint32_t C_PENDING = 1;
+
+        // UnitEntry flags
+        static constexpr uint32_t C_PORTS = 1;
+
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t entry_count;
+            uint32_t name_count;
+            uint32_t hash_algorithm;
+            uint64_t string_size;
+            uint32_t directory_count;
+            uint32_t elaborated_count;
+            uint64_t ignore_hash;
+            int64_t scanned_at;
+            uint32_t unit_count;
+            uint32_t reserved;
+            uint64_t backend_hash;
+        };
+
+        struct NameRef {
+            uint32_t offset;
+            uint32_t length;
+        };
+
+        struct Entry {
+            NameRef path;
+            uint64_t hash;
+            int64_t mtime;
+            uint64_t size;
+            uint64_t inode;
+            uint32_t units_begin;
+            uint32_t units_count;
+            uint32_t duration;
+            uint32_t flags;
+        };
+
+        struct UnitEntry {
+            NameRef name;
+            uint64_t hash;
+            uint32_t kind;
+            uint32_t references_begin;
+            uint32_t references_count;
+            uint32_t flags;
+        };
+
+        struct Directory {
+            NameRef path;
+            int64_t mtime;
+            uint32_t files_begin;
+            uint32_t files_count;
+            uint32_t directories_begin;
+            uint32_t directories_count;
+        };
+
+        struct Elaborated {
+            NameRef entity;
+            uint64_t fingerprint;
+            int64_t mtime;
+            uint64_t size;
+            uint64_t inode;
+        };
+
+        // A missing, damaged or outdated file results in an empty cache
+        explicit Cache(const std::string& path);
+
+        const Entry* find(std::string_view path) const;
+        Unit to_unit(const Entry& entry) const;
+
+        // All entries, as the graph of the last build
+        std::vector<Unit> get_units() const;
+        FileStat stat(const Entry& entry) const;
+
+        // Directory listings of the scan that wrote the cache
+        DirectorySnapshot get_snapshot() const;
+
+        // Time of the scan that wrote the cache, in nanoseconds since the epoch
+        int64_t get_scanned_at() const { return scanned_at; }
+
+        std::vector<Elaboration> get_elaborations() const;
+
+        // Backend::analysis_hash of the build that wrote the cache
+        uint64_t get_backend_hash() const { return backend_hash; }
+
+        size_t size() const { return entry_count; }
+        bool is_outdated() const { return outdated; }
+        bool is_hash_changed() const { return hash_changed; }
+
+        static bool save(const std::string& path, std::vector<const Unit*> units, const DirectorySnapshot& snapshot = {},
+                         const std::vector<Elaboration>& elaborations = {}, uint64_t backend_hash = 0);
+
+    private:
+        std::string_view string(const NameRef& ref) const;
+
+        MappedFile file;
+        const Entry* entries = nullptr;
+        const UnitEntry* unit_entries = nullptr;
+        const Directory* directories = nullptr;
+        const Elaborated* elaborated = nullptr;
+        const NameRef* names = nullptr;
+        const char* strings = nullptr;
+        size_t entry_count = 0;
+        size_t directory_count = 0;
+        size_t elaborated_count = 0;
+        uint64_t ignore_hash = 0;
+        int64_t scanned_at = 0;
+        uint64_t backend_hash = 0;
+        bool outdated = false;
+        bool hash_changed = false;
+    };
+} // namespace vm
+
+#endif
@@ -1,7 +1,21 @@
+#ifndef CONSTANTS_HPP
+#define CONSTANTS_HPP
+
 #include <string_view>
 
 namespace vm
 {
     constexpr std::string_view C_VCD_DIRECTORY = "ghw";
     constexpr std::string_view C_CACHE_FILE = ".vhdlmake";
+    constexpr std::string_view C_JOB_DIRECTORY = ".vhdlmake.d";
+    constexpr std::string_view C_JOURNAL_FILE = ".vhdlmake.journal";
+    constexpr std::string_view C_NINJA_FILE = "build.ninja";
+    constexpr std::string_view C_NINJA_DIRECTORY = ".vhdlmake.ninja";
+    constexpr std::string_view C_WORK_LIBRARY = "work-obj08.cf";
+    constexpr std::string_view C_IGNORE_FILE = ".vhdlmakeignore";
+    constexpr std::string_view C_CONFIG_FILE = "vhdlmake.json";
+    constexpr std::string_view C_STORE_DIRECTORY = "vhdlmake";
+    constexpr int C_WATCH_DEBOUNCE_MS = 100;
 } // namespace vm
+
+#endif
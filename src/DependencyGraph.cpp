@@ -2,120 +2,516 @@
 #include "Unit.hpp"
 #include "Constants.hpp"
 #include "Utility.hpp"
+#include "Cache.hpp"
+#include "Scanner.hpp"
+#include "Trace.hpp"
+#include "Hash.hpp"
+#include "Lexer.hpp"
 
 #include <filesystem>
 #include <iostream>
 #include <sstream>
-#include <nlohmann/json.hpp>
 #include <queue>
 #include <fstream>
 #include <stack>
 #include <random>
 #include <algorithm>
+#include <thread>
+#include <fnmatch.h>
 
 namespace fs = std::filesystem;
-using json = nlohmann::json;
 
 namespace vm {
-    Node::Node(const Unit& unit) : data(unit), in(0) { }
+    static constexpr NodeId C_NO_NODE = Interner::C_NONE;
 
-    DependencyGraph::DependencyGraph() {
+    // Builds a CSR adjacency from an unsorted edge list, duplicates are dropped
+    static Adjacency make_adjacency(size_t nodes, std::vector<std::pair<NodeId, NodeId>>& edges) {
+        std::sort(edges.begin(), edges.end());
+        edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+        Adjacency adjacency;
+        adjacency.offsets.assign(nodes + 1, 0);
+        adjacency.targets.reserve(edges.size());
+        for(const auto& [from, to] : edges) {
+            adjacency.offsets[from + 1]++;
+            adjacency.targets.push_back(to);
+        }
+
+        for(size_t i = 0; i < nodes; i++) {
+            adjacency.offsets[i + 1] += adjacency.offsets[i];
+        }
+
+        return adjacency;
+    }
+
+    DependencyGraph::DependencyGraph(const Options& options) : options(options) {
         build_dag(fs::current_path());
     }
 
+    // True if the new version of a file only differs from the old one in comments,
+    // whitespace or case. The library still holds the same units then, so the file
+    // isn't analysed again and its users aren't either.
+    static bool same_design_units(const Unit& before, const Unit& after) {
+        if(before.design_units.size() != after.design_units.size()) {
+            return false;
+        }
+
+        for(size_t i = 0; i < after.design_units.size(); i++) {
+            const DesignUnit& old = before.design_units[i];
+            const DesignUnit& unit = after.design_units[i];
+            if(old.kind != unit.kind || old.name != unit.name || old.hash != unit.hash) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    DependencyGraph::DependencyGraph(std::vector<Unit> units, std::vector<uint8_t> changed, const Options& options)
+        : options(options), units(std::move(units)) {
+        std::sort(this->units.begin(), this->units.end(), [](const Unit& a, const Unit& b) {
+            return a.path < b.path;
+        });
+
+        this->changed.resize(this->units.size());
+        for(size_t i = 0; i < std::min(changed.size(), this->changed.size()); i++) {
+            this->changed[i] = changed[i] ? 1 : 0;
+        }
+        resolve();
+    }
+
     void DependencyGraph::build_dag(const std::string& directory) {
         // Load cache
-        json cache;
-        if(fs::exists(C_CACHE_FILE)) {
-            std::string cache_file(C_CACHE_FILE);
-            std::ifstream file (cache_file);
-            file >> cache;
+        Cache cache {std::string(C_CACHE_FILE)};
+        if(cache.is_hash_changed()) {
+            std::cerr << "[INFO] Cache uses a different hash algorithm, rebuilding everything" << std::endl;
+        } else if(cache.is_outdated()) {
+            std::cerr << "[INFO] Cache format changed, rebuilding everything" << std::endl;
+        }
+
+        // The library was analysed with other settings, none of it can be kept
+        const bool backend_changed = cache.size() != 0 && cache.get_backend_hash() != options.backend.analysis_hash();
+        if(backend_changed) {
+            std::cerr << "[INFO] Backend or analysis flags changed, rebuilding everything" << std::endl;
+        }
+
+        Scanner scanner(directory);
+        std::vector<std::string> paths = scanner.scan(cache.get_snapshot());
+        snapshot = scanner.get_snapshot();
+        elaborations = cache.get_elaborations();
+        std::vector<Journal::Record> journal;
+        if(!backend_changed) {
+            journal = Journal::read(std::string(C_JOURNAL_FILE));
+        }
+
+        {
+            Trace::Scope scope("parse");
+
+            // Scan files in parallel, every worker only writes its own slot
+            units.resize(paths.size());
+            changed.resize(paths.size());
+            parallel_for(paths.size(), std::thread::hardware_concurrency(), [&](size_t i) {
+                const std::string& relative_path = paths[i];
+                const Cache::Entry* entry = cache.find(relative_path);
+                FileStat stat = FileStat::from_file(relative_path);
+
+                // Only read and rehash the file if its stat data changed. A file written
+                // shortly before the last scan may have been written again since, within
+                // the granularity of the mtime.
+                if(!options.paranoid && entry != nullptr && cache.stat(*entry) == stat
+                        && stat.mtime < cache.get_scanned_at() - C_MTIME_SLACK_NS) {
+                    units[i] = cache.to_unit(*entry);
+                } else {
+                    units[i] = Unit::from_file(relative_path);
+                    units[i].stat = stat;
+
+                    // Edits rarely change how long a file takes, keep the old estimate
+                    if(entry != nullptr) {
+                        units[i].duration = entry->duration;
+                    }
+                }
+
+                if(entry == nullptr || backend_changed) {
+                    changed[i] = 1;
+                } else if(units[i].hash != entry->hash) {
+                    changed[i] = !same_design_units(cache.to_unit(*entry), units[i]);
+                } else {
+                    changed[i] = 0;
+                }
+
+                // Left over by a build of another target, its dependants are pending as well
+                if(entry != nullptr && (entry->flags & Cache::C_PENDING)) {
+                    units[i].pending = true;
+                    changed[i] = 1;
+                }
+            });
         }
 
-        // Iterate over all vhdl files
-        fs::recursive_directory_iterator working_dir (directory);
-        for(const auto& file_path : working_dir) {
-            if(file_path.path().extension() != ".vhdl") {
+        resolve();
+        if(replay(journal)) {
+            build_partial_dag();
+        }
+    }
+
+    bool DependencyGraph::replay(const std::vector<Journal::Record>& journal) {
+        if(journal.empty()) {
+            return false;
+        }
+
+        // The cache still describes the files as they were before the failed
+        // build, only the last record of every file counts
+        std::unordered_map<std::string_view, const Journal::Record*> latest;
+        for(const auto& record : journal) {
+            latest[record.path] = &record;
+        }
+
+        size_t done = 0;
+        for(const auto& [path, record] : latest) {
+            auto it = path_to_node.find(std::string(path));
+            if(it == path_to_node.end()) {
                 continue;
             }
 
-            // Directory iterator uses absolute paths, so we convert them to relative here
-            std::string relative_path = fs::relative(file_path, directory).string();
+            NodeId node = it->second;
+            if(!record->done) {
+                changed[node] = 1;
+            } else if(record->hash == units[node].hash) {
+                // The library holds this version, its dependants were recorded as pending if they need it
+                changed[node] = 0;
+                if(record->duration != 0) {
+                    units[node].duration = record->duration;
+                }
+                done++;
+            } else {
+                // Changed again since the build that left the journal
+                changed[node] = 1;
+            }
+        }
+
+        std::cerr << "[INFO] Resuming the last build, " << done << " files are already analysed" << std::endl;
+        return true;
+    }
+
+    void DependencyGraph::resolve() {
+        Trace::Scope scope("resolve");
+        const size_t count = units.size();
 
-            Unit unit = Unit::from_file(relative_path);
+        path_to_node.clear();
+        identifiers.clear();
+        ident_to_unit.clear();
+        unit_offsets.assign(count + 1, 0);
+        unit_to_node.clear();
 
-            // Associate the file path with the defined entities
-            for(const auto& entity : unit.definitions)  {
-                this->ident_to_file[entity] = relative_path;
+        // Number the design units and associate the identifiers with the primary unit that defines them
+        for(NodeId node = 0; node < count; node++) {
+            path_to_node[units[node].path] = node;
+            unit_offsets[node] = unit_to_node.size();
+
+            for(const auto& unit : units[node].design_units) {
+                uint32_t unit_id = unit_to_node.size();
+                unit_to_node.push_back(node);
+                if(!is_primary(unit.kind)) {
+                    continue;
+                }
+
+                uint32_t id = identifiers.intern(unit.name);
+                if(id >= ident_to_unit.size()) {
+                    ident_to_unit.resize(id + 1, C_NO_NODE);
+                }
+                ident_to_unit[id] = unit_id;
             }
+        }
+        unit_offsets[count] = unit_to_node.size();
+
+        // Resolve references to edges between units and between their files
+        std::vector<std::pair<NodeId, NodeId>> forward;
+        std::vector<std::pair<NodeId, NodeId>> backward;
+        std::vector<std::pair<uint32_t, uint32_t>> unit_forward;
+        std::vector<std::pair<uint32_t, uint32_t>> unit_backward;
+        for(NodeId node = 0; node < count; node++) {
+            for(const auto& dependency : units[node].references) {
+                uint32_t id = identifiers.find(dependency);
+                if(id == Interner::C_NONE || id >= ident_to_unit.size() || ident_to_unit[id] == C_NO_NODE) {
+                    std::cerr << "[WARN] Unresolved Dependency '" << dependency << "' in file " << units[node].path << std::endl;
+                }
+            }
+
+            for(uint32_t unit = unit_offsets[node]; unit < unit_offsets[node + 1]; unit++) {
+                for(const auto& dependency : design_unit(unit).references) {
+                    uint32_t id = identifiers.find(dependency);
+                    if(id == Interner::C_NONE || id >= ident_to_unit.size() || ident_to_unit[id] == C_NO_NODE) {
+                        continue;
+                    }
+
+                    uint32_t target = ident_to_unit[id];
+                    unit_forward.emplace_back(target, unit);
+                    unit_backward.emplace_back(unit, target);
+
+                    // Units in the same file are analysed together anyway
+                    if(unit_to_node[target] != node) {
+                        forward.emplace_back(unit_to_node[target], node);
+                        backward.emplace_back(node, unit_to_node[target]);
+                    }
+                }
+            }
+        }
+
+        dependants = make_adjacency(count, forward);
+        dependencies = make_adjacency(count, backward);
+        unit_dependants = make_adjacency(unit_to_node.size(), unit_forward);
+        unit_dependencies = make_adjacency(unit_to_node.size(), unit_backward);
+
+        build_partial_dag();
+    }
 
-            // Add Node to DAG
-            dag[relative_path] = std::make_shared<Node>(unit);
+    const DesignUnit& DependencyGraph::design_unit(uint32_t id) const {
+        NodeId node = unit_to_node[id];
+        return units[node].design_units[id - unit_offsets[node]];
+    }
+
+    bool DependencyGraph::in_partial_dag(NodeId node) const {
+        return partial[node / 64] & (uint64_t(1) << (node % 64));
+    }
 
-            // Add file to change list, if hashes don't match
-            if(unit.hash != cache[relative_path]) {
-                //std::cerr << relative_path << " changed" << std::endl;
-                this->changed_units.emplace(dag[relative_path]);
+    void DependencyGraph::build_partial_dag() {
+        Trace::Scope scope("partial dag");
+        const size_t count = units.size();
+        partial.assign((count + 63) / 64, 0);
+        partial_in.assign(count, 0);
+
+        // A file is analysed as a whole, which gives all of its primary units a new
+        // date in the library, so everything that references one of them is out of
+        // date as well. The change only stops at files without primary units.
+        std::vector<NodeId> to_visit;
+        for(NodeId node = 0; node < count; node++) {
+            if(changed[node] != 0) {
+                to_visit.push_back(node);
             }
         }
 
-        // Resolve dependants
-        for(const auto& [path, unit] : dag) {
-            for(const auto& dependency : unit->data.references) {
-                if(ident_to_file.find(dependency) == ident_to_file.end()) {
-                    std::cerr << "[WARN] Unresolved Dependency '" << dependency << "' in file " << path << std::endl;
+        std::vector<uint8_t> visited(count, 0);
+        while(!to_visit.empty()) {
+            NodeId node = to_visit.back();
+            to_visit.pop_back();
+            if(visited[node]) {
+                continue;
+            }
+            visited[node] = 1;
+
+            for(uint32_t unit = unit_offsets[node]; unit < unit_offsets[node + 1]; unit++) {
+                // Nothing can reference an architecture or package body
+                if(!is_primary(design_unit(unit).kind)) {
                     continue;
                 }
 
-                const std::string& dep_file_name = this->ident_to_file[dependency];
-                dag[dep_file_name]->dependants.push_back(unit);
-                unit->in++;
+                for(uint32_t dep : unit_dependants[unit]) {
+                    if(!visited[unit_to_node[dep]]) {
+                        to_visit.push_back(unit_to_node[dep]);
+                    }
+                }
             }
         }
 
-        // Build Partial DAG which only contains files that were changed
-        for(const auto& unit : changed_units) {
-           build_partial_dag(unit);
+        size_t nodes = 0;
+        for(NodeId node = 0; node < count; node++) {
+            if(visited[node]) {
+                partial[node / 64] |= uint64_t(1) << (node % 64);
+                nodes++;
+            }
         }
 
+        for(NodeId node = 0; node < count; node++) {
+            if(!in_partial_dag(node)) {
+                continue;
+            }
+
+            for(NodeId dep : dependants[node]) {
+                if(in_partial_dag(dep)) {
+                    partial_in[dep]++;
+                }
+            }
+        }
+
+        Trace::set(Trace::PARTIAL_DAG_NODES, nodes);
     }
 
-    void DependencyGraph::build_partial_dag(const std::shared_ptr<Node>& unit) {
-           if(partial_dag.find(unit->data.path) != partial_dag.end()) {
-                return;
+    void DependencyGraph::update(const std::vector<std::string>& files) {
+        Trace::Scope scope("update");
+
+        // Dependants of deleted files have to be analysed again to report the
+        // missing units, collect them before node ids shift
+        std::vector<std::string> invalidated;
+        for(const auto& path : files) {
+            auto it = path_to_node.find(path);
+            if(it != path_to_node.end() && !fs::exists(path)) {
+                for(NodeId dep : dependants[it->second]) {
+                    invalidated.push_back(units[dep].path);
+                }
             }
+        }
+
+        for(const auto& path : files) {
+            auto it = std::lower_bound(units.begin(), units.end(), path, [](const Unit& unit, const std::string& p) {
+                return unit.path < p;
+            });
+            bool known = it != units.end() && it->path == path;
+            size_t index = it - units.begin();
 
-            partial_dag[unit->data.path] = std::make_shared<Node>(unit->data);
-            
-            for(const auto& dep : dag[unit->data.path]->dependants) {
-                build_partial_dag(dep);
-                
-                partial_dag[unit->data.path]->dependants.emplace_back(partial_dag[dep->data.path]);     
-                partial_dag[dep->data.path]->in++;
+            // Deleted files simply drop out of the graph
+            if(!fs::exists(path)) {
+                if(known) {
+                    units.erase(it);
+                    changed.erase(changed.begin() + index);
+                }
+                continue;
+            }
+
+            Unit unit = Unit::from_file(path);
+            unit.stat = FileStat::from_file(path);
+
+            if(!known) {
+                units.insert(it, unit);
+                changed.insert(changed.begin() + index, 1);
+                continue;
             }
+
+            // Files may already be changed and not yet built
+            changed[index] |= unit.hash != it->hash && !same_design_units(*it, unit);
+            unit.duration = it->duration;
+            unit.pending = it->pending;
+            *it = unit;
+        }
+
+        for(const auto& path : invalidated) {
+            auto it = std::lower_bound(units.begin(), units.end(), path, [](const Unit& unit, const std::string& p) {
+                return unit.path < p;
+            });
+            if(it != units.end() && it->path == path) {
+                changed[it - units.begin()] = 1;
+            }
+        }
+
+        resolve();
     }
-    
-    std::vector<std::string> DependencyGraph::get_update_list() {
+
+    void DependencyGraph::invalidate(const std::vector<std::string>& files) {
+        for(const auto& path : files) {
+            auto it = path_to_node.find(path);
+            if(it != path_to_node.end()) {
+                changed[it->second] = 1;
+            }
+        }
+
+        build_partial_dag();
+    }
+
+    void DependencyGraph::commit() {
+        std::fill(changed.begin(), changed.end(), 0);
+        for(auto& unit : units) {
+            unit.pending = false;
+        }
+        build_partial_dag();
+    }
+
+    void DependencyGraph::commit(const BuildPlan& plan) {
+        std::vector<uint8_t> done(units.size(), 0);
+        for(const auto& step : plan) {
+            auto it = path_to_node.find(step.path);
+            if(it != path_to_node.end() && step.done) {
+                done[it->second] = 1;
+            }
+        }
+
+        // Dependants of a finished file that changed are in the partial DAG themselves,
+        // so the rest of it is still complete without the changes of the finished ones
+        for(NodeId node = 0; node < units.size(); node++) {
+            if(done[node]) {
+                changed[node] = 0;
+                units[node].pending = false;
+            } else if(in_partial_dag(node)) {
+                changed[node] = 1;
+                units[node].pending = true;
+            }
+        }
+
+        build_partial_dag();
+    }
+
+    std::vector<uint64_t> DependencyGraph::get_priorities() const {
+        const size_t count = units.size();
+
+        // Files that were never analysed are assumed to take the average time
+        uint64_t total = 0;
+        uint64_t known = 0;
+        for(const auto& unit : units) {
+            if(unit.duration != 0) {
+                total += unit.duration;
+                known++;
+            }
+        }
+        const uint64_t fallback = known != 0 ? total / known : 1;
+
+        // Any topological order of the partial DAG will do here
+        std::vector<NodeId> order;
+        std::vector<uint32_t> in = partial_in;
+        for(NodeId node = 0; node < count; node++) {
+            if(in_partial_dag(node) && in[node] == 0) {
+                order.push_back(node);
+            }
+        }
+        for(size_t i = 0; i < order.size(); i++) {
+            for(NodeId dep : dependants[order[i]]) {
+                if(--in[dep] == 0) {
+                    order.push_back(dep);
+                }
+            }
+        }
+
+        // Longest weighted path from every node to the end of the build,
+        // dependants of a node in the partial DAG are always part of it too
+        std::vector<uint64_t> priority(count, 0);
+        for(auto it = order.rbegin(); it != order.rend(); it++) {
+            uint64_t longest = 0;
+            for(NodeId dep : dependants[*it]) {
+                longest = std::max(longest, priority[dep]);
+            }
+
+            uint32_t duration = units[*it].duration;
+            priority[*it] = (duration != 0 ? duration : fallback) + longest;
+        }
+
+        return priority;
+    }
+
+    std::vector<std::string> DependencyGraph::get_update_list() const {
         std::vector<std::string> list;
-        std::stack<std::shared_ptr<Node>> to_visit;
-        
+        std::vector<uint32_t> in = partial_in;
+        std::vector<uint64_t> priority = get_priorities();
+
+        // Critical path first: of all ready nodes, the one gating the longest
+        // remaining chain is started next. Ties go to the lower id.
+        auto compare = [&](NodeId a, NodeId b) {
+            return priority[a] != priority[b] ? priority[a] < priority[b] : a > b;
+        };
+        std::priority_queue<NodeId, std::vector<NodeId>, decltype(compare)> to_visit(compare);
+
         // Enqueue all node with no incoming endges
-        for(const auto& [path, node] : partial_dag) {
-            if(node->in == 0) {
+        for(NodeId node = 0; node < units.size(); node++) {
+            if(in_partial_dag(node) && in[node] == 0) {
                 to_visit.push(node);
             }
         }
 
         // Perform Topological Sort using Kahn's Algorithm
         while(!to_visit.empty()) {
-            std::shared_ptr<Node> node = to_visit.top();
+            NodeId node = to_visit.top();
             to_visit.pop();
 
-            list.push_back(node->data.path);
+            list.push_back(units[node].path);
 
-            for(const auto& dep : node->dependants) {
-                dep->in--;
-                if(dep->in == 0) {
+            for(NodeId dep : dependants[node]) {
+                in[dep]--;
+                if(in[dep] == 0) {
                     to_visit.push(dep);
                 }
             }
@@ -124,37 +520,538 @@ namespace vm {
         return list;
     }
 
-    void DependencyGraph::save_cache() const {
-        std::string cache_file(C_CACHE_FILE);
-        std::ofstream file(cache_file);
+    std::vector<uint64_t> DependencyGraph::get_artifact_keys() const {
+        const NodeId count = units.size();
+        std::vector<uint64_t> keys(count, 0);
+
+        // Dependencies first, nodes on a cycle and everything that depends on
+        // them are never reached and keep 0
+        std::vector<NodeId> order;
+        std::vector<uint32_t> in(count);
+        for(NodeId node = 0; node < count; node++) {
+            in[node] = dependencies[node].size();
+            if(in[node] == 0) {
+                order.push_back(node);
+            }
+        }
+
+        for(size_t i = 0; i < order.size(); i++) {
+            NodeId node = order[i];
+            const Unit& unit = units[node];
+
+            Hasher hasher;
+            hasher.update(std::string_view(unit.path.c_str(), unit.path.size() + 1));
+            hasher.update(std::string_view(reinterpret_cast<const char*>(&unit.hash), sizeof(unit.hash)));
+            for(NodeId dep : dependencies[node]) {
+                hasher.update(std::string_view(reinterpret_cast<const char*>(&keys[dep]), sizeof(keys[dep])));
+            }
+            keys[node] = std::max<uint64_t>(hasher.digest(), 1);
+
+            for(NodeId dep : dependants[node]) {
+                if(--in[dep] == 0) {
+                    order.push_back(dep);
+                }
+            }
+        }
+
+        return keys;
+    }
+
+    BuildPlan DependencyGraph::get_build_plan(const std::string& target) const {
+        BuildPlan plan;
+        std::vector<size_t> index(units.size(), SIZE_MAX);
+        std::vector<uint64_t> priority = get_priorities();
+        std::vector<uint64_t> keys = get_artifact_keys();
+
+        // Dependencies of a file in the closure are in it too, so the steps
+        // within it never wait for one outside. Unknown targets build everything.
+        std::vector<uint8_t> closure = target != "" ? get_closure(target) : std::vector<uint8_t> {};
+        size_t skipped = 0;
 
-        if(!file.is_open()) {
-            std::cerr << "Could not open cache file" << std::endl;
+        // Steps are stored in topological order, so running them one after
+        // another is always valid
+        for(const auto& path : get_update_list()) {
+            NodeId node = path_to_node.at(path);
+            if(!closure.empty() && !closure[node]) {
+                skipped++;
+                continue;
+            }
+
+            index[node] = plan.size();
+            plan.push_back(BuildStep { .path = path, .priority = priority[node], .key = keys[node], .hash = units[node].hash });
+        }
+
+        // Only steps of the plan count as predecessors, a step waiting for one that
+        // isn't in it would never become ready
+        for(auto& step : plan) {
+            for(NodeId dep : dependants[path_to_node.at(step.path)]) {
+                // Nodes on a cycle never make it into the update list
+                if(index[dep] != SIZE_MAX) {
+                    step.dependants.push_back(index[dep]);
+                    plan[index[dep]].in++;
+                }
+            }
+        }
+
+        if(skipped != 0) {
+            std::cerr << "[INFO] " << skipped << " changed files are not needed for " << target << ", leaving them for later" << std::endl;
+        }
+
+        return plan;
+    }
+
+    void DependencyGraph::record_durations(const BuildPlan& plan) {
+        for(const auto& step : plan) {
+            auto it = path_to_node.find(step.path);
+            if(step.duration != 0 && it != path_to_node.end()) {
+                units[it->second].duration = step.duration;
+            }
+        }
+    }
+
+    std::vector<uint32_t> DependencyGraph::get_neighbours(uint32_t unit, bool reverse) const {
+        const DesignUnit& current = design_unit(unit);
+        std::vector<uint32_t> result;
+
+        if(!reverse) {
+            result.assign(unit_dependencies[unit].begin(), unit_dependencies[unit].end());
+
+            // Whatever uses a primary unit also gets its architectures and package body
+            if(is_primary(current.kind)) {
+                for(uint32_t dep : unit_dependants[unit]) {
+                    const DesignUnit& secondary = design_unit(dep);
+                    if(!is_primary(secondary.kind) && secondary.primary() == current.name) {
+                        result.push_back(dep);
+                    }
+                }
+            }
+            return result;
+        }
+
+        result.assign(unit_dependants[unit].begin(), unit_dependants[unit].end());
+        if(!is_primary(current.kind)) {
+            uint32_t id = identifiers.find(current.primary());
+            if(id != Interner::C_NONE && id < ident_to_unit.size() && ident_to_unit[id] != C_NO_NODE) {
+                result.push_back(ident_to_unit[id]);
+            }
+        }
+        return result;
+    }
+
+    std::vector<uint32_t> DependencyGraph::find_units(const std::string& name) const {
+        std::vector<uint32_t> result;
+
+        auto it = path_to_node.find(name);
+        if(it != path_to_node.end()) {
+            for(uint32_t unit = unit_offsets[it->second]; unit < unit_offsets[it->second + 1]; unit++) {
+                result.push_back(unit);
+            }
+            return result;
+        }
+
+        uint32_t id = identifiers.find(to_lower(name));
+        if(id != Interner::C_NONE && id < ident_to_unit.size() && ident_to_unit[id] != C_NO_NODE) {
+            result.push_back(ident_to_unit[id]);
+        }
+        return result;
+    }
+
+    std::vector<std::string> DependencyGraph::get_testbenches(const std::string& pattern) const {
+        std::vector<std::string> result;
+        const std::string lower = to_lower(pattern);
+
+        for(uint32_t unit = 0; unit < unit_to_node.size(); unit++) {
+            const DesignUnit& entity = design_unit(unit);
+            if(entity.kind != UnitKind::ENTITY) {
+                continue;
+            }
+
+            if(pattern != "") {
+                if(fnmatch(lower.c_str(), entity.name.c_str(), 0) == 0) {
+                    result.push_back(entity.name);
+                }
+                continue;
+            }
+
+            // Configurations of a testbench don't make it a component
+            bool architecture = false;
+            bool used = false;
+            for(uint32_t dep : unit_dependants[unit]) {
+                const DesignUnit& other = design_unit(dep);
+                if(other.kind == UnitKind::ARCHITECTURE && other.primary() == entity.name) {
+                    architecture = true;
+                } else if(other.kind != UnitKind::CONFIGURATION) {
+                    used = true;
+                }
+            }
+
+            if(!entity.ports && architecture && !used) {
+                result.push_back(entity.name);
+            }
+        }
+
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    bool DependencyGraph::contains(const std::string& name) const {
+        return !find_units(name).empty();
+    }
+
+    std::vector<std::string> DependencyGraph::get_dependencies(const std::string& name, bool reverse) const {
+        std::vector<uint32_t> to_visit = find_units(name);
+        std::vector<uint8_t> visited(unit_to_node.size(), 0);
+        std::vector<uint8_t> reached(units.size(), 0);
+
+        std::vector<uint8_t> start(units.size(), 0);
+        for(uint32_t unit : to_visit) {
+            start[unit_to_node[unit]] = 1;
+        }
+
+        while(!to_visit.empty()) {
+            uint32_t unit = to_visit.back();
+            to_visit.pop_back();
+
+            if(visited[unit]) {
+                continue;
+            }
+            visited[unit] = 1;
+            reached[unit_to_node[unit]] = 1;
+
+            for(uint32_t next : get_neighbours(unit, reverse)) {
+                to_visit.push_back(next);
+            }
+        }
+
+        std::vector<std::string> result;
+        for(NodeId node = 0; node < units.size(); node++) {
+            if(reached[node] && !start[node]) {
+                result.push_back(units[node].path);
+            }
+        }
+        return result;
+    }
+
+    std::vector<std::string> DependencyGraph::get_path(const std::string& from, const std::string& to) const {
+        constexpr uint32_t C_START = UINT32_MAX - 1;
+        std::vector<uint32_t> parent(unit_to_node.size(), C_NO_NODE);
+        std::vector<uint8_t> target(unit_to_node.size(), 0);
+        for(uint32_t unit : find_units(to)) {
+            target[unit] = 1;
+        }
+
+        // Breadth first, so the first target that is reached has the shortest chain
+        std::queue<uint32_t> to_visit;
+        for(uint32_t unit : find_units(from)) {
+            parent[unit] = C_START;
+            to_visit.push(unit);
+        }
+
+        uint32_t found = C_NO_NODE;
+        while(!to_visit.empty()) {
+            uint32_t unit = to_visit.front();
+            to_visit.pop();
+
+            if(target[unit]) {
+                found = unit;
+                break;
+            }
+
+            for(uint32_t next : get_neighbours(unit, false)) {
+                if(parent[next] == C_NO_NODE) {
+                    parent[next] = unit;
+                    to_visit.push(next);
+                }
+            }
+        }
+
+        std::vector<std::string> chain;
+        for(uint32_t unit = found; unit != C_NO_NODE && unit != C_START; unit = parent[unit]) {
+            const DesignUnit& current = design_unit(unit);
+            chain.push_back(std::string(kind_name(current.kind)) + " " + current.name + " (" + units[unit_to_node[unit]].path + ")");
+        }
+        std::reverse(chain.begin(), chain.end());
+        return chain;
+    }
+
+    void DependencyGraph::write_dot(std::ostream& stream) const {
+        stream << "digraph vhdlmake {\n";
+        stream << "  rankdir=LR;\n";
+        stream << "  node [shape=box];\n";
+
+        // One cluster per file, edges point from a unit to the units that use it
+        for(NodeId node = 0; node < units.size(); node++) {
+            stream << "  subgraph cluster_" << node << " {\n";
+            stream << "    label=" << json_quote(units[node].path) << ";\n";
+            for(uint32_t unit = unit_offsets[node]; unit < unit_offsets[node + 1]; unit++) {
+                const DesignUnit& current = design_unit(unit);
+                stream << "    u" << unit << " [label=" << json_quote(std::string(kind_name(current.kind)) + " " + current.name) << "];\n";
+            }
+            stream << "  }\n";
+        }
+
+        for(uint32_t unit = 0; unit < unit_to_node.size(); unit++) {
+            for(uint32_t dep : unit_dependants[unit]) {
+                stream << "  u" << unit << " -> u" << dep << ";\n";
+            }
+        }
+
+        stream << "}\n";
+    }
+
+    // Paths in build statements escape spaces, colons and dollar signs
+    static std::string ninja_escape(std::string_view path) {
+        std::string escaped;
+        for(char c : path) {
+            if(c == ' ' || c == ':' || c == '$') {
+                escaped += '$';
+            }
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    bool DependencyGraph::write_ninja(std::ostream& stream, const NinjaRules& rules) const {
+        // Ninja has no escape for line breaks
+        for(const auto& unit : units) {
+            if(unit.path.find('\n') != std::string::npos) {
+                std::cerr << "[ERROR] build.ninja can't refer to files with line breaks in their name: " << json_quote(unit.path) << std::endl;
+                return false;
+            }
+        }
+
+        auto stamp = [&](NodeId node) {
+            return ninja_escape(std::string(C_NINJA_DIRECTORY) + "/" + units[node].path + ".stamp");
+        };
+
+        // GHDL rewrites the library index on every analysis, so only one may run at a time.
+        // The console pool needs 1.5.
+        stream << "ninja_required_version = 1.5\n\n";
+        stream << "pool analysis\n  depth = 1\n\n";
+        stream << "rule analyse\n  command = " << rules.analyse << "\n  description = COMPILE $in\n  pool = analysis\n\n";
+        stream << "rule elaborate\n  command = " << rules.elaborate << "\n  description = LINK ${entity}\n  pool = analysis\n\n";
+        stream << "rule run\n  command = " << rules.run << "\n  description = RUN ${entity}\n  pool = console\n\n";
+        stream << "rule regenerate\n  command = " << rules.regenerate << "\n  description = Checking build.ninja\n"
+               << "  generator = 1\n  restat = 1\n\n";
+
+        // New files, new dependencies and the config can only be found by scanning, so
+        // that runs first every time. The file is only rewritten if the graph changed.
+        const std::string always = std::string(C_NINJA_DIRECTORY) + "/always";
+        stream << "build " << always << ": phony\n";
+        stream << "build " << C_NINJA_FILE << ": regenerate | " << always << "\n\n";
+
+        // A file is analysed again if it or one of the files it depends on changed
+        for(NodeId node = 0; node < units.size(); node++) {
+            stream << "build " << stamp(node) << ": analyse " << ninja_escape(units[node].path);
+            if(!dependencies[node].empty()) {
+                stream << " |";
+                for(NodeId dep : dependencies[node]) {
+                    stream << " " << stamp(dep);
+                }
+            }
+            stream << "\n";
+        }
+
+        for(uint32_t unit = 0; unit < unit_to_node.size(); unit++) {
+            const DesignUnit& entity = design_unit(unit);
+            if(entity.kind != UnitKind::ENTITY) {
+                continue;
+            }
+
+            bool architecture = std::any_of(unit_dependants[unit].begin(), unit_dependants[unit].end(), [&](uint32_t dep) {
+                return design_unit(dep).kind == UnitKind::ARCHITECTURE && design_unit(dep).primary() == entity.name;
+            });
+            if(!architecture) {
+                continue;
+            }
+
+            // mcode GHDL writes no binary, so the elaboration leaves a stamp as well.
+            // Running is never up to date.
+            std::string elaborated = ninja_escape(std::string(C_NINJA_DIRECTORY) + "/" + entity.name + ".elab");
+            std::vector<uint8_t> closure = get_closure(entity.name);
+            stream << "\nbuild " << elaborated << ": elaborate |";
+            for(NodeId node = 0; node < units.size(); node++) {
+                if(closure[node]) {
+                    stream << " " << stamp(node);
+                }
+            }
+            stream << "\n  entity = " << entity.name << "\n";
+            stream << "build elaborate-" << ninja_escape(entity.name) << ": phony " << elaborated << "\n";
+            stream << "build run-" << ninja_escape(entity.name) << ": run | " << elaborated << "\n";
+            stream << "  entity = " << entity.name << "\n";
+        }
+
+        stream << "\nbuild all: phony";
+        for(NodeId node = 0; node < units.size(); node++) {
+            stream << " " << stamp(node);
+        }
+        stream << "\n\ndefault all\n";
+        return true;
+    }
+
+    void DependencyGraph::write_json(std::ostream& stream) const {
+        stream << "{\"units\": [";
+        for(uint32_t unit = 0; unit < unit_to_node.size(); unit++) {
+            const DesignUnit& current = design_unit(unit);
+            stream << (unit == 0 ? "\n" : ",\n");
+            stream << "  {\"id\": " << unit
+                   << ", \"kind\": " << json_quote(kind_name(current.kind))
+                   << ", \"name\": " << json_quote(current.name)
+                   << ", \"file\": " << json_quote(units[unit_to_node[unit]].path)
+                   << ", \"dependencies\": [";
+
+            bool first = true;
+            for(uint32_t dep : unit_dependencies[unit]) {
+                stream << (first ? "" : ", ") << dep;
+                first = false;
+            }
+            stream << "]}";
+        }
+        stream << "\n]}\n";
+    }
+
+    std::vector<uint8_t> DependencyGraph::get_closure(const std::string& entity) const {
+        uint32_t id = identifiers.find(to_lower(entity));
+        if(id == Interner::C_NONE || id >= ident_to_unit.size() || ident_to_unit[id] == C_NO_NODE) {
+            return {};
+        }
+
+        // Everything the entity depends on, including the architectures and package
+        // bodies that end up in the binary although nothing references them. A file
+        // is analysed as a whole, so the other units of a file in the closure need
+        // their dependencies as well.
+        std::vector<uint8_t> visited(unit_to_node.size(), 0);
+        std::vector<uint8_t> in_closure(units.size(), 0);
+        std::vector<uint32_t> to_visit { ident_to_unit[id] };
+        while(!to_visit.empty()) {
+            uint32_t unit = to_visit.back();
+            to_visit.pop_back();
+
+            if(visited[unit]) {
+                continue;
+            }
+            visited[unit] = 1;
+
+            NodeId node = unit_to_node[unit];
+            if(!in_closure[node]) {
+                in_closure[node] = 1;
+                for(uint32_t other = unit_offsets[node]; other < unit_offsets[node + 1]; other++) {
+                    to_visit.push_back(other);
+                }
+            }
+
+            for(uint32_t dep : get_neighbours(unit, false)) {
+                to_visit.push_back(dep);
+            }
+        }
+
+        return in_closure;
+    }
+
+    uint64_t DependencyGraph::get_fingerprint(const std::string& entity) const {
+        std::vector<uint8_t> in_closure = get_closure(entity);
+        if(in_closure.empty()) {
+            return 0;
+        }
+
+        // Files are hashed in node order, which follows the paths
+        // Elaboration flags don't touch the library, but they do change the binary
+        uint64_t flags = options.backend.elaboration_hash();
+        Hasher hasher;
+        hasher.update(to_lower(entity));
+        hasher.update(std::string_view(reinterpret_cast<const char*>(&flags), sizeof(flags)));
+        for(NodeId node = 0; node < units.size(); node++) {
+            if(!in_closure[node]) {
+                continue;
+            }
+
+            // Over the design units, the library doesn't change with comments either
+            const Unit& unit = units[node];
+            hasher.update(std::string_view(unit.path.c_str(), unit.path.size() + 1));
+            for(const auto& design_unit : unit.design_units) {
+                hasher.update(std::string_view(reinterpret_cast<const char*>(&design_unit.hash), sizeof(design_unit.hash)));
+            }
+        }
+
+        // Never 0, that means unknown
+        return std::max<uint64_t>(hasher.digest(), 1);
+    }
+
+    bool DependencyGraph::is_elaborated(const std::string& entity) const {
+        uint64_t fingerprint = get_fingerprint(entity);
+        if(fingerprint == 0) {
+            return false;
+        }
+
+        for(const auto& elaboration : elaborations) {
+            if(elaboration.entity == to_lower(entity)) {
+                // GHDL names the binary after the entity in lower case. mcode GHDL and NVC
+                // keep the elaborated design in memory or in the library, there is no binary
+                // on either side then and the fingerprint decides.
+                return elaboration.fingerprint == fingerprint && elaboration.binary == FileStat::from_file(elaboration.entity);
+            }
+        }
+
+        return false;
+    }
+
+    void DependencyGraph::record_elaboration(const std::string& entity) {
+        uint64_t fingerprint = get_fingerprint(entity);
+        if(fingerprint == 0) {
             return;
         }
 
-        json data;
-        for(const auto& unit : this->dag) {
-            data[unit.first] = unit.second->data.hash;
+        Elaboration elaboration {
+            .entity = to_lower(entity),
+            .fingerprint = fingerprint,
+            .binary = FileStat::from_file(to_lower(entity))
+        };
+
+        auto it = std::find_if(elaborations.begin(), elaborations.end(), [&](const Elaboration& e) {
+            return e.entity == elaboration.entity;
+        });
+        if(it != elaborations.end()) {
+            *it = std::move(elaboration);
+        } else {
+            elaborations.push_back(std::move(elaboration));
         }
+    }
 
-        file << data;
+    void DependencyGraph::save_cache() const {
+        std::vector<const Unit*> list;
+        for(const auto& unit : units) {
+            list.push_back(&unit);
+        }
+
+        if(!Cache::save(std::string(C_CACHE_FILE), list, snapshot, elaborations, options.backend.analysis_hash())) {
+            std::cerr << "Could not write cache file" << std::endl;
+            return;
+        }
+
+        // Everything the journal recorded is in the cache now
+        Journal::remove(std::string(C_JOURNAL_FILE));
     }
 
     void DependencyGraph::debug_print() const {
         std::cout << "Ident to File: " << std::endl;
-        for(const auto& node : this->ident_to_file) {
-            std::cout << node.first << " -> " << node.second << std::endl;
+        for(uint32_t id = 0; id < ident_to_unit.size(); id++) {
+            if(ident_to_unit[id] != C_NO_NODE) {
+                std::cout << identifiers.name(id) << " -> " << units[unit_to_node[ident_to_unit[id]]].path << std::endl;
+            }
         }
 
         std::cout << std::endl << "Dag Data: " << std::endl;
-        for(const auto& node : this->partial_dag) {
-            std::cout << std::setw(4) << "Path: "<< node.second->data.path << std::endl;
+        for(NodeId node = 0; node < units.size(); node++) {
+            if(!in_partial_dag(node)) {
+                continue;
+            }
+
+            std::cout << std::setw(4) << "Path: "<< units[node].path << std::endl;
             std::cout << std::setw(4) << "Dependants: " << std::endl;
-            for(const auto& dependant : node.second->dependants) {
-                std::cout << "  " << dependant->data.path << std::endl;
+            for(NodeId dependant : dependants[node]) {
+                std::cout << "  " << units[dependant].path << std::endl;
             }
-            std::cout << std::setw(4) << "In: " << node.second->in << std::endl;
+            std::cout << std::setw(4) << "In: " << partial_in[node] << std::endl;
 
             std::cout << std::endl;
         }
@@ -162,40 +1059,52 @@ namespace vm {
 
     std::vector<std::string> DependencyGraph::get_minimal_subset() {
         std::vector<std::string> result;
+        std::vector<uint8_t> visited(units.size(), 0);
+        std::stack<NodeId> to_visit;
+
+        if(options.since.empty()) {
+            // Files whose hash differs from the cache, as found by build_dag
+            for(NodeId node = 0; node < units.size(); node++) {
+                if(changed[node]) {
+                    to_visit.push(node);
+                }
+            }
+        } else {
+            // Changes since a revision, including untracked files. Nothing is staged.
+            std::vector<std::string> files = command_get_lines("git diff --name-only --relative " + shell_quote(options.since));
+            for(auto& file : command_get_lines("git ls-files --others --exclude-standard")) {
+                files.push_back(std::move(file));
+            }
 
-        system("git add .");
-        std::vector<std::string> files = command_get_lines("git diff --name-only --cached");
+            for(const auto& file : files) {
+                if(!is_source_file(file)) {
+                    continue;
+                }
 
-        std::unordered_map<std::string, bool> visited;
-        std::stack<std::string> to_visit;
-      
-        for(const auto& file : files) {
-            if(file.ends_with(".vhdl")) {
-                to_visit.emplace(file);
+                auto it = path_to_node.find(file);
+                if(it == path_to_node.end()) {
+                    std::cerr << "[WARN] Could not find file " << file << std::endl;
+                    continue;
+                }
+                to_visit.push(it->second);
             }
         }
 
+        // Add everything the changed files depend on
         while(!to_visit.empty()) {
-            std::string file = to_visit.top();
+            NodeId node = to_visit.top();
             to_visit.pop();
 
-            if(visited[file]) {
+            if(visited[node]) {
                 continue;
             }
+            visited[node] = 1;
 
-            result.push_back(file);
+            result.push_back(units[node].path);
 
-            if(dag.find(file) == dag.end()) {
-                std::cerr << "[WARN] Could not find file " << file << std::endl;
-                visited[file] = true;
-                continue;
+            for(NodeId dep : dependencies[node]) {
+                to_visit.push(dep);
             }
-
-            for(const auto& dep : dag[file]->data.references) {
-                to_visit.emplace(ident_to_file[dep]);
-            }
-
-            visited[file] = true;
         }
 
         return result;
@@ -203,8 +1112,6 @@ namespace vm {
 
 
     std::string DependencyGraph::get_mermaid_url(bool partial) const {
-        auto& p_dag = partial ? partial_dag : dag;
- 
         std::stringstream d;
         d << "{ \"code\": \"%%{init: {\\\"flowchart\\\": {\\\"defaultRenderer\\\": \\\"elk\\\"}} }%%\\n";
         d << "flowchart LR\\n";
@@ -212,23 +1119,24 @@ namespace vm {
         d << "classDef c stroke:cyan\\n";
         d << "classDef t stroke:orange\\n";
 
-        for(const auto& [path, unit] : p_dag) {
-            if(unit->data.path.contains("constant_package")) {
+        for(NodeId node = 0; node < units.size(); node++) {
+            const std::string& path = units[node].path;
+            if((partial && !in_partial_dag(node)) || path.contains("constant_package")) {
                 continue;
             }
 
-            d << unit->data.path;
-            if(unit->data.path.contains("components")) {
+            d << path;
+            if(path.contains("components")) {
                 d << ":::c";
-            } else if(unit->data.path.contains("testbenches")) {
+            } else if(path.contains("testbenches")) {
                 d << ":::t";
-            } else if(unit->data.path.contains("packages")) {
+            } else if(path.contains("packages")) {
                 d << ":::p";
             }
             d << "\\n";
 
-            for(const auto& dep : unit->dependants) {
-                d << unit->data.path << "-->" << dep->data.path << "\\n";
+            for(NodeId dep : dependants[node]) {
+                d << path << "-->" << units[dep].path << "\\n";
             }
         }
 
@@ -1,39 +1,188 @@
+#ifndef DEPENDENCY_GRAPH_HPP
+#define DEPENDENCY_GRAPH_HPP
+
 #include "Unit.hpp"
+#include "Options.hpp"
+#include "Interner.hpp"
+#include "Scanner.hpp"
+#include "Journal.hpp"
 
 #include <string>
+#include <ostream>
 #include <unordered_map>
-#include <memory>
 #include <vector>
-#include <unordered_set>
+#include <span>
+#include <cstdint>
 
 namespace vm {
-    struct Node {
-        explicit Node(const Unit& unit);
-        std::vector<std::shared_ptr<Node>> dependants;
-        Unit data;
+    using NodeId = uint32_t;
+
+    // Compressed sparse row adjacency, the neighbours of node n are
+    // targets[offsets[n]] up to targets[offsets[n + 1]]
+    struct Adjacency {
+        std::vector<uint32_t> offsets;
+        std::vector<NodeId> targets;
+
+        std::span<const NodeId> operator[](NodeId node) const {
+            return std::span<const NodeId>(targets.data() + offsets[node], offsets[node + 1] - offsets[node]);
+        }
+    };
+
+    // One analysis job of the partial DAG, dependants are indices into the plan
+    struct BuildStep {
+        std::string path;
+        std::vector<size_t> dependants;
         int in = 0;
+
+        // Expected time until the build is done if this step starts now
+        uint64_t priority = 0;
+
+        // Measured by the builder in microseconds
+        uint32_t duration = 0;
+
+        // Identifies the result of the analysis: hash over the path, the content and
+        // the keys of all files this one depends on. 0 for files on a cycle.
+        uint64_t key = 0;
+
+        // Content hash of the file
+        uint64_t hash = 0;
+
+        // Set by the builder once the file is in the library, analysed or restored
+        bool done = false;
     };
 
+    using BuildPlan = std::vector<BuildStep>;
 
+    // Shell commands of a generated build.ninja. The analysis gets the file as $in,
+    // the others get ${entity}. Analysis and elaboration have to create the stamp $out.
+    struct NinjaRules {
+        std::string analyse;
+        std::string elaborate;
+        std::string run;
+        std::string regenerate;
+    };
+
+
+    // Files are the nodes that get analysed, and a file is analysed as a whole.
+    // That gives every primary unit in it, like an entity or package declaration,
+    // a new date in the library, so the units that reference any of them are out
+    // of date as well. Architectures and package bodies can't be referenced, so a
+    // change stops at files that only contain those.
     class DependencyGraph {
     public:
-        DependencyGraph();
+        explicit DependencyGraph(const Options& options = {});
 
-        std::vector<std::string> get_update_list();
+        // Builds the graph from already parsed units instead of scanning the working directory
+        DependencyGraph(std::vector<Unit> units, std::vector<uint8_t> changed, const Options& options = {});
+
+        std::vector<std::string> get_update_list() const;
+        // Steps for all files of the partial DAG, or with a target entity only those it is built from
+        BuildPlan get_build_plan(const std::string& target = "") const;
         std::vector<std::string> get_minimal_subset();
 
+        // Parses the given files again and recomputes the partial DAG
+        void update(const std::vector<std::string>& files);
+
+        // Marks files as changed without parsing them again
+        void invalidate(const std::vector<std::string>& files);
+
+        // Marks all files of the partial DAG as built
+        void commit();
+
+        // Marks the finished steps of a build as built. The other files of the partial
+        // DAG stay in it and are saved as pending, like the ones a scoped build skipped.
+        void commit(const BuildPlan& plan);
+
+        // Remembers the analysis times of a build for scheduling the next one
+        void record_durations(const BuildPlan& plan);
+
+        // Hash over the sources an entity is elaborated from, 0 if no file defines it
+        uint64_t get_fingerprint(const std::string& entity) const;
+
+        // True if the entity was elaborated from the current sources and its binary is untouched
+        bool is_elaborated(const std::string& entity) const;
+
+        // Remembers a successful elaboration of the entity
+        void record_elaboration(const std::string& entity);
+
+        // True if a design unit or file has this name
+        bool contains(const std::string& name) const;
+
+        // Entities `vhdlmake test` simulates, sorted by name. With a pattern those whose
+        // name matches it, otherwise those without ports that have an architecture and
+        // aren't used by any other unit.
+        std::vector<std::string> get_testbenches(const std::string& pattern = "") const;
+
+        // Files a design unit or file depends on, directly or not, or with `reverse`
+        // the files that depend on it. Architectures and package bodies count as part
+        // of their primary unit. Empty if nothing has this name.
+        std::vector<std::string> get_dependencies(const std::string& name, bool reverse) const;
+
+        // Shortest chain of design units that makes `from` depend on `to`, empty if there is none
+        std::vector<std::string> get_path(const std::string& from, const std::string& to) const;
+
+        // Write the design units and their dependencies as they go, one unit at a time
+        void write_dot(std::ostream& stream) const;
+        void write_json(std::ostream& stream) const;
+
+        // Write a build.ninja with one analysis edge per file, which waits for the
+        // stamps of the files it depends on, and elaborate and run edges per entity.
+        // False if a path can't be written in ninja syntax.
+        bool write_ninja(std::ostream& stream, const NinjaRules& rules) const;
+
         void save_cache() const;
         void debug_print() const;
         std::string get_mermaid_url(bool partial) const;
 
     private:
         void build_dag(const std::string& directory);
-        void build_partial_dag(const std::shared_ptr<Node>& node);
+        void resolve();
+        void build_partial_dag();
+        std::vector<uint64_t> get_priorities() const;
+        std::vector<uint64_t> get_artifact_keys() const;
+        std::vector<uint8_t> get_closure(const std::string& entity) const;
+        bool in_partial_dag(NodeId node) const;
+        bool replay(const std::vector<Journal::Record>& journal);
+        const DesignUnit& design_unit(uint32_t id) const;
+        std::vector<uint32_t> find_units(const std::string& name) const;
+        std::vector<uint32_t> get_neighbours(uint32_t unit, bool reverse) const;
 
-        std::unordered_map<std::string, std::shared_ptr<Node>> dag;
-        std::unordered_map<std::string, std::shared_ptr<Node>> partial_dag;
+        Options options;
 
-        std::unordered_map<std::string, std::string> ident_to_file;
-        std::unordered_set<std::shared_ptr<Node>> changed_units;
+        // Nodes are sorted by path, the index is the node id
+        std::vector<Unit> units;
+        std::unordered_map<std::string, NodeId> path_to_node;
+
+        // Set for every file that has to be analysed again, the partial DAG
+        // adds the files that reference its primary units
+        std::vector<uint8_t> changed;
+
+        // Directory listings of the last scan, saved to skip unchanged directories next time
+        DirectorySnapshot snapshot;
+
+        std::vector<Elaboration> elaborations;
+
+        // Design units of all files numbered one after another, the units of
+        // node n start at unit_offsets[n]
+        std::vector<uint32_t> unit_offsets;
+        std::vector<NodeId> unit_to_node;
+
+        // Identifiers are resolved to the primary unit that defines them
+        Interner identifiers;
+        std::vector<uint32_t> ident_to_unit;
+
+        // Edges between files, used to order the analysis
+        Adjacency dependants;
+        Adjacency dependencies;
+
+        // Edges between design units, used to find out what has to be analysed
+        Adjacency unit_dependants;
+        Adjacency unit_dependencies;
+
+        // Partial DAG as a bitset over node ids and the in-degree within it
+        std::vector<uint64_t> partial;
+        std::vector<uint32_t> partial_in;
     };
 } // namespace vm
+
+#endif
@@ -0,0 +1,302 @@
+#include "Executor.hpp"
+
+#include <iostream>
+#include <utility>
+#include <csignal>
+#include <cstring>
+#include <cerrno>
+#include <spawn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+namespace vm {
+    // Events of job n carry 2n for its pidfd and 2n + 1 for its output pipe
+    static constexpr uint64_t C_SIGNAL_EVENT = UINT64_MAX;
+
+    static sigset_t forwarded_signals() {
+        sigset_t set;
+        sigemptyset(&set);
+        for(int signal : {SIGINT, SIGTERM, SIGHUP, SIGQUIT}) {
+            sigaddset(&set, signal);
+        }
+        return set;
+    }
+
+    static int exit_status(int status) {
+        if(WIFEXITED(status)) {
+            return WEXITSTATUS(status);
+        }
+        return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : 1;
+    }
+
+    Executor::Executor() {
+        sigset_t set = forwarded_signals();
+        pthread_sigmask(SIG_BLOCK, &set, &previous_mask);
+
+        signals = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+        epoll = epoll_create1(EPOLL_CLOEXEC);
+        if(signals < 0 || epoll < 0) {
+            std::cerr << "[ERROR] Could not initialize process executor: " << std::strerror(errno) << std::endl;
+            return;
+        }
+
+        epoll_event event { .events = EPOLLIN, .data = { .u64 = C_SIGNAL_EVENT } };
+        epoll_ctl(epoll, EPOLL_CTL_ADD, signals, &event);
+    }
+
+    Executor::~Executor() {
+        // Nobody waits for the remaining jobs anymore, so they are stopped
+        for(auto& [id, job] : jobs) {
+            send_signal(job, SIGTERM);
+        }
+
+        for(auto& [id, job] : jobs) {
+            waitpid(job.pid, nullptr, 0);
+            close(job.pidfd);
+            if(job.output >= 0) {
+                close(job.output);
+            }
+        }
+
+        if(epoll >= 0) {
+            close(epoll);
+        }
+        if(signals >= 0) {
+            close(signals);
+        }
+        pthread_sigmask(SIG_SETMASK, &previous_mask, nullptr);
+    }
+
+    Executor::JobId Executor::start(const std::vector<std::string>& args, bool capture) {
+        JobId id = next_id++;
+        Job job;
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+
+        int pipe_fds[2] = { -1, -1 };
+        if(capture && pipe2(pipe_fds, O_CLOEXEC) == 0) {
+            posix_spawn_file_actions_adddup2(&actions, pipe_fds[1], STDOUT_FILENO);
+            posix_spawn_file_actions_adddup2(&actions, pipe_fds[1], STDERR_FILENO);
+        }
+
+        // Children get the default signal handling back, so Ctrl-C still reaches them
+        posix_spawnattr_t attributes;
+        posix_spawnattr_init(&attributes);
+        sigset_t empty;
+        sigemptyset(&empty);
+        sigset_t defaults = forwarded_signals();
+        posix_spawnattr_setsigmask(&attributes, &empty);
+        posix_spawnattr_setsigdefault(&attributes, &defaults);
+        short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+
+        // Captured jobs don't need the terminal, in a process group of their own
+        // a signal also reaches the processes they start, like the gcc backend
+        if(capture) {
+            posix_spawnattr_setpgroup(&attributes, 0);
+            flags |= POSIX_SPAWN_SETPGROUP;
+            job.group = true;
+        }
+        posix_spawnattr_setflags(&attributes, flags);
+
+        std::vector<char*> argv;
+        for(const auto& arg : args) {
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+
+        int error = args.empty() ? EINVAL : posix_spawnp(&job.pid, argv[0], &actions, &attributes, argv.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attributes);
+        if(pipe_fds[1] >= 0) {
+            close(pipe_fds[1]);
+        }
+
+        if(error != 0) {
+            if(pipe_fds[0] >= 0) {
+                close(pipe_fds[0]);
+            }
+
+            std::string program = args.empty() ? "" : args[0];
+            finished.push_back({ id, 127, "Could not start " + program + ": " + std::strerror(error) + "\n" });
+            return id;
+        }
+
+        // pidfds need Linux 5.3, without them the exit can't be waited for together with the output
+        job.pidfd = syscall(SYS_pidfd_open, job.pid, 0);
+        if(job.pidfd < 0) {
+            error = errno;
+            kill(job.pid, SIGKILL);
+            waitpid(job.pid, nullptr, 0);
+            if(pipe_fds[0] >= 0) {
+                close(pipe_fds[0]);
+            }
+
+            finished.push_back({ id, 127, std::string("Could not watch process: ") + std::strerror(error) + "\n" });
+            return id;
+        }
+
+        epoll_event event { .events = EPOLLIN, .data = { .u64 = id * 2 } };
+        epoll_ctl(epoll, EPOLL_CTL_ADD, job.pidfd, &event);
+
+        if(pipe_fds[0] >= 0) {
+            job.output = pipe_fds[0];
+            fcntl(job.output, F_SETFL, fcntl(job.output, F_GETFL) | O_NONBLOCK);
+
+            event = { .events = EPOLLIN, .data = { .u64 = id * 2 + 1 } };
+            epoll_ctl(epoll, EPOLL_CTL_ADD, job.output, &event);
+        }
+
+        jobs.emplace(id, std::move(job));
+        return id;
+    }
+
+    void Executor::send_signal(const Job& job, int signal) {
+        if(job.group) {
+            kill(-job.pid, signal);
+        } else {
+            syscall(SYS_pidfd_send_signal, job.pidfd, signal, nullptr, 0);
+        }
+    }
+
+    void Executor::read_output(Job& job) {
+        char buffer[64 * 1024];
+
+        while(job.output >= 0) {
+            ssize_t length = read(job.output, buffer, sizeof(buffer));
+            if(length > 0) {
+                job.buffer.append(buffer, length);
+                continue;
+            }
+
+            if(length < 0 && (errno == EAGAIN || errno == EINTR)) {
+                return;
+            }
+
+            // End of file or a broken pipe, either way there is nothing more to read
+            epoll_ctl(epoll, EPOLL_CTL_DEL, job.output, nullptr);
+            close(job.output);
+            job.output = -1;
+        }
+    }
+
+    Executor::Result Executor::finish(JobId id) {
+        Job& job = jobs.at(id);
+
+        // Everything the process wrote is in the pipe by now. Whatever its own
+        // children still write after it exited is lost.
+        read_output(job);
+        if(job.output >= 0) {
+            epoll_ctl(epoll, EPOLL_CTL_DEL, job.output, nullptr);
+            close(job.output);
+        }
+
+        epoll_ctl(epoll, EPOLL_CTL_DEL, job.pidfd, nullptr);
+        close(job.pidfd);
+
+        int status = 0;
+        waitpid(job.pid, &status, 0);
+
+        Result result { id, exit_status(status), std::move(job.buffer) };
+        jobs.erase(id);
+        return result;
+    }
+
+    void Executor::forward_signal(int signal) {
+        std::cerr << "[INFO] Stopping " << jobs.size() << " running jobs" << std::endl;
+        for(auto& [id, job] : jobs) {
+            send_signal(job, signal);
+        }
+
+        for(auto& [id, job] : jobs) {
+            waitpid(job.pid, nullptr, 0);
+        }
+        jobs.clear();
+
+        // Terminate through the same signal, so the calling shell sees how we ended
+        pthread_sigmask(SIG_SETMASK, &previous_mask, nullptr);
+        std::signal(signal, SIG_DFL);
+        raise(signal);
+        std::_Exit(128 + signal);
+    }
+
+    void Executor::stop(JobId id) {
+        auto it = jobs.find(id);
+        if(it != jobs.end()) {
+            send_signal(it->second, SIGKILL);
+        }
+    }
+
+    std::vector<Executor::Result> Executor::wait(int timeout_ms) {
+        while(finished.empty() && !jobs.empty()) {
+            epoll_event events[16];
+            int count = epoll_wait(epoll, events, 16, timeout_ms);
+            if(count == 0) {
+                break;
+            }
+
+            if(count < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+
+                // Without epoll the jobs can't be observed anymore, end them instead of hanging
+                std::cerr << "[ERROR] Waiting for jobs failed: " << std::strerror(errno) << std::endl;
+                while(!jobs.empty()) {
+                    send_signal(jobs.begin()->second, SIGKILL);
+                    finished.push_back(finish(jobs.begin()->first));
+                }
+                break;
+            }
+
+            for(int i = 0; i < count; i++) {
+                uint64_t key = events[i].data.u64;
+                if(key == C_SIGNAL_EVENT) {
+                    signalfd_siginfo info;
+                    if(read(signals, &info, sizeof(info)) == sizeof(info)) {
+                        forward_signal(info.ssi_signo);
+                    }
+                    continue;
+                }
+
+                // The job may have been finished by an earlier event of this round
+                auto it = jobs.find(key / 2);
+                if(it == jobs.end()) {
+                    continue;
+                }
+
+                if(key % 2 == 1) {
+                    read_output(it->second);
+                } else {
+                    finished.push_back(finish(key / 2));
+                }
+            }
+
+            // Jobs that keep writing would otherwise delay the timeout forever
+            if(timeout_ms >= 0) {
+                break;
+            }
+        }
+
+        return std::exchange(finished, {});
+    }
+
+    int Executor::run(const std::vector<std::string>& args, bool capture) {
+        Executor executor;
+        executor.start(args, capture);
+
+        int status = 0;
+        for(const auto& result : executor.wait()) {
+            std::cerr << result.output;
+            status = result.status;
+        }
+        return status;
+    }
+} // namespace vm
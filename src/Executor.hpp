@@ -0,0 +1,76 @@
+#ifndef EXECUTOR_HPP
+#define EXECUTOR_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <signal.h>
+#include <sys/types.h>
+
+namespace vm {
+    // Runs external programs without a shell. Processes are started with
+    // posix_spawn and their exit is observed through pidfds on an epoll
+    // instance, so a single thread can keep many commands in flight.
+    //
+    // While an executor exists SIGINT, SIGTERM, SIGHUP and SIGQUIT are blocked
+    // and read from a signalfd instead. When one arrives it is forwarded to all
+    // running jobs and their process groups, they are reaped, and then the
+    // signal is raised again, so vhdlmake never leaves orphaned ghdl processes.
+    class Executor {
+    public:
+        using JobId = uint64_t;
+
+        struct Result {
+            JobId id;
+            int status;             // exit code, 128 + signal number if the process was killed
+            std::string output;     // stdout and stderr of captured jobs
+        };
+
+        Executor();
+        ~Executor();
+
+        Executor(const Executor&) = delete;
+        Executor& operator=(const Executor&) = delete;
+
+        // Starts args[0], searched in PATH. Captured jobs write into a buffer that is
+        // returned once they finished, the others write directly to the terminal.
+        // If the program can't be started, the job finishes with status 127.
+        JobId start(const std::vector<std::string>& args, bool capture = true);
+
+        // Blocks until at least one job finished and returns all finished jobs. With a
+        // timeout in milliseconds it may also return early without any.
+        std::vector<Result> wait(int timeout_ms = -1);
+
+        // Kills a running job and the processes it started, wait() still returns it
+        void stop(JobId id);
+
+        size_t running() const { return jobs.size(); }
+
+        // Starts a single job, waits for it and prints its output
+        static int run(const std::vector<std::string>& args, bool capture = true);
+
+    private:
+        struct Job {
+            pid_t pid = -1;
+            int pidfd = -1;
+            int output = -1;
+            bool group = false;
+            std::string buffer;
+        };
+
+        static void send_signal(const Job& job, int signal);
+        void read_output(Job& job);
+        Result finish(JobId id);
+        [[noreturn]] void forward_signal(int signal);
+
+        int epoll = -1;
+        int signals = -1;
+        sigset_t previous_mask;
+        JobId next_id = 0;
+        std::unordered_map<JobId, Job> jobs;
+        std::vector<Result> finished;
+    };
+} // namespace vm
+
+#endif
@@ -0,0 +1,129 @@
+#include "Hash.hpp"
+
+#include <bit>
+#include <cstring>
+
+namespace vm {
+    static constexpr uint64_t C_PRIME_1 = 0x9E3779B185EBCA87ULL;
+    static constexpr uint64_t C_PRIME_2 = 0xC2B2AE3D27D4EB4FULL;
+    static constexpr uint64_t C_PRIME_3 = 0x165667B19E3779F9ULL;
+    static constexpr uint64_t C_PRIME_4 = 0x85EBCA77C2B2AE63ULL;
+    static constexpr uint64_t C_PRIME_5 = 0x27D4EB2F165667C5ULL;
+
+    static inline uint64_t read64(const unsigned char* ptr) {
+        uint64_t value;
+        std::memcpy(&value, ptr, sizeof(value));
+        if constexpr (std::endian::native == std::endian::big) {
+            value = __builtin_bswap64(value);
+        }
+        return value;
+    }
+
+    static inline uint32_t read32(const unsigned char* ptr) {
+        uint32_t value;
+        std::memcpy(&value, ptr, sizeof(value));
+        if constexpr (std::endian::native == std::endian::big) {
+            value = __builtin_bswap32(value);
+        }
+        return value;
+    }
+
+    static inline uint64_t round(uint64_t acc, uint64_t input) {
+        acc += input * C_PRIME_2;
+        acc = std::rotl(acc, 31);
+        return acc * C_PRIME_1;
+    }
+
+    static inline uint64_t merge_round(uint64_t acc, uint64_t lane) {
+        acc ^= round(0, lane);
+        return acc * C_PRIME_1 + C_PRIME_4;
+    }
+
+    static inline void stripe(uint64_t* lanes, const unsigned char* ptr) {
+        lanes[0] = round(lanes[0], read64(ptr));
+        lanes[1] = round(lanes[1], read64(ptr + 8));
+        lanes[2] = round(lanes[2], read64(ptr + 16));
+        lanes[3] = round(lanes[3], read64(ptr + 24));
+    }
+
+    Hasher::Hasher() {
+        lanes[0] = C_PRIME_1 + C_PRIME_2;
+        lanes[1] = C_PRIME_2;
+        lanes[2] = 0;
+        lanes[3] = -C_PRIME_1;
+    }
+
+    void Hasher::update(std::string_view data) {
+        const unsigned char* ptr = reinterpret_cast<const unsigned char*>(data.data());
+        const unsigned char* end = ptr + data.size();
+        total += data.size();
+
+        // Complete a stripe left over from the previous update
+        if(buffered > 0) {
+            size_t take = std::min<size_t>(32 - buffered, end - ptr);
+            std::memcpy(buffer + buffered, ptr, take);
+            buffered += take;
+            ptr += take;
+
+            if(buffered < 32) {
+                return;
+            }
+            stripe(lanes, buffer);
+            buffered = 0;
+        }
+
+        while(end - ptr >= 32) {
+            stripe(lanes, ptr);
+            ptr += 32;
+        }
+
+        std::memcpy(buffer, ptr, end - ptr);
+        buffered = end - ptr;
+    }
+
+    uint64_t Hasher::digest() const {
+        uint64_t hash;
+        if(total >= 32) {
+            hash = std::rotl(lanes[0], 1) + std::rotl(lanes[1], 7) + std::rotl(lanes[2], 12) + std::rotl(lanes[3], 18);
+            for(uint64_t lane : lanes) {
+                hash = merge_round(hash, lane);
+            }
+        } else {
+            hash = C_PRIME_5;
+        }
+
+        hash += total;
+
+        const unsigned char* ptr = buffer;
+        const unsigned char* end = buffer + buffered;
+        for(; end - ptr >= 8; ptr += 8) {
+            hash ^= round(0, read64(ptr));
+            hash = std::rotl(hash, 27) * C_PRIME_1 + C_PRIME_4;
+        }
+
+        if(end - ptr >= 4) {
+            hash ^= uint64_t(read32(ptr)) * C_PRIME_1;
+            hash = std::rotl(hash, 23) * C_PRIME_2 + C_PRIME_3;
+            ptr += 4;
+        }
+
+        for(; ptr < end; ptr++) {
+            hash ^= *ptr * C_PRIME_5;
+            hash = std::rotl(hash, 11) * C_PRIME_1;
+        }
+
+        // Avalanche
+        hash ^= hash >> 33;
+        hash *= C_PRIME_2;
+        hash ^= hash >> 29;
+        hash *= C_PRIME_3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+    uint64_t hash64(std::string_view data) {
+        Hasher hasher;
+        hasher.update(data);
+        return hasher.digest();
+    }
+} // namespace vm
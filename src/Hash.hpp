@@ -0,0 +1,32 @@
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include <string_view>
+#include <cstdint>
+
+namespace vm {
+    // Identifies the content hash in the cache, bump when the hash changes
+    constexpr uint32_t C_HASH_ALGORITHM = 1;
+
+    // Streaming XXH64 (seed 0) as specified in the xxHash specification.
+    // The result is stable across compilers, standard libraries and platforms.
+    // The four accumulator lanes are independent, so 32 byte stripes are
+    // processed without dependencies between the multiplications.
+    class Hasher {
+    public:
+        Hasher();
+
+        void update(std::string_view data);
+        uint64_t digest() const;
+
+    private:
+        uint64_t lanes[4];
+        uint64_t total = 0;
+        unsigned char buffer[32];
+        size_t buffered = 0;
+    };
+
+    uint64_t hash64(std::string_view data);
+} // namespace vm
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef INTERNER_HPP
+#define INTERNER_HPP
+
+#include <string>
+#include <string_view>
+#include <deque>
+#include <unordered_map>
+#include <cstdint>
+
+namespace vm {
+    // Maps strings to dense ids, so the graph can work with integers
+    class Interner {
+    public:
+        static constexpr uint32_t C_NONE = UINT32_MAX;
+
+        uint32_t intern(std::string_view name) {
+            auto it = ids.find(name);
+            if(it != ids.end()) {
+                return it->second;
+            }
+
+            uint32_t id = static_cast<uint32_t>(names.size());
+            names.emplace_back(name);
+            ids.emplace(names.back(), id);
+            return id;
+        }
+
+        uint32_t find(std::string_view name) const {
+            auto it = ids.find(name);
+            return it != ids.end() ? it->second : C_NONE;
+        }
+
+        const std::string& name(uint32_t id) const { return names[id]; }
+        size_t size() const { return names.size(); }
+
+        void clear() {
+            ids.clear();
+            names.clear();
+        }
+
+    private:
+        // A deque never moves its elements, so the views in `ids` stay valid
+        std::deque<std::string> names;
+        std::unordered_map<std::string_view, uint32_t> ids;
+    };
+} // namespace vm
+
+#endif
@@ -0,0 +1,101 @@
+#include "Journal.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace vm {
+    // Records look like
+    //   pending src/adder.vhdl
+    //   done 1f2e3d4c5b6a7980 1500 src/adder.vhdl
+    // with the content hash in hex and the analysis time in microseconds
+    static std::string done_line(const Journal::Record& record) {
+        char fields[64];
+        std::snprintf(fields, sizeof(fields), "done %016llx %u ", static_cast<unsigned long long>(record.hash), record.duration);
+        return fields + record.path + "\n";
+    }
+
+    Journal::Journal(const std::string& path) {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if(fd < 0) {
+            std::cerr << "[WARN] Could not open " << path << ", progress of a failed build is lost" << std::endl;
+        }
+    }
+
+    Journal::~Journal() {
+        if(fd >= 0) {
+            close(fd);
+        }
+    }
+
+    bool Journal::append(const std::string& lines) {
+        if(fd < 0 || lines.empty()) {
+            return false;
+        }
+
+        // A single write to an O_APPEND file, readers see either all of it or a cut off last line
+        size_t written = 0;
+        while(written < lines.size()) {
+            ssize_t length = write(fd, lines.data() + written, lines.size() - written);
+            if(length < 0 && errno == EINTR) {
+                continue;
+            }
+            if(length <= 0) {
+                return false;
+            }
+            written += length;
+        }
+        return true;
+    }
+
+    bool Journal::pending(const std::vector<std::string>& paths) {
+        std::string lines;
+        for(const auto& path : paths) {
+            lines += "pending " + path + "\n";
+        }
+        return append(lines);
+    }
+
+    bool Journal::done(const std::vector<Record>& records) {
+        std::string lines;
+        for(const auto& record : records) {
+            lines += done_line(record);
+        }
+        return append(lines);
+    }
+
+    std::vector<Journal::Record> Journal::read(const std::string& path) {
+        std::vector<Record> records;
+        std::ifstream file(path);
+        std::string line;
+
+        while(std::getline(file, line)) {
+            // The last line misses its newline if the write was interrupted
+            if(file.eof()) {
+                break;
+            }
+
+            if(line.starts_with("pending ")) {
+                records.push_back(Record { .path = line.substr(8) });
+                continue;
+            }
+
+            unsigned long long hash = 0;
+            unsigned duration = 0;
+            int offset = 0;
+            if(std::sscanf(line.c_str(), "done %16llx %u %n", &hash, &duration, &offset) == 2 && offset > 0
+                    && static_cast<size_t>(offset) < line.size()) {
+                records.push_back(Record { .path = line.substr(offset), .done = true, .hash = hash, .duration = duration });
+            }
+        }
+
+        return records;
+    }
+
+    void Journal::remove(const std::string& path) {
+        std::remove(path.c_str());
+    }
+} // namespace vm
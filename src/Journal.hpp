@@ -0,0 +1,51 @@
+#ifndef JOURNAL_HPP
+#define JOURNAL_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace vm {
+    // Append-only log of the analyses of a build that hasn't been saved to the
+    // cache yet. Before the first job starts all files of the plan are recorded
+    // as pending, every file is recorded as done as soon as its analysis
+    // succeeded. Each record is one line written with a single append, a line
+    // that was cut off by a crash is ignored when the journal is read.
+    //
+    // The cache only changes after a successful build, which also removes the
+    // journal. Until then the journal tells which files of a failed build are
+    // already in the library, so the next build doesn't analyse them again.
+    class Journal {
+    public:
+        struct Record {
+            std::string path;
+            bool done = false;
+            uint64_t hash = 0;      // content hash the file was analysed with
+            uint32_t duration = 0;
+        };
+
+        explicit Journal(const std::string& path);
+        ~Journal();
+
+        Journal(const Journal&) = delete;
+        Journal& operator=(const Journal&) = delete;
+
+        bool is_open() const { return fd >= 0; }
+
+        bool pending(const std::vector<std::string>& paths);
+        bool done(const std::vector<Record>& records);
+
+        // All complete records in the order they were written
+        static std::vector<Record> read(const std::string& path);
+
+        // Called once the cache holds everything the journal knows
+        static void remove(const std::string& path);
+
+    private:
+        bool append(const std::string& lines);
+
+        int fd = -1;
+    };
+} // namespace vm
+
+#endif
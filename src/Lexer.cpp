@@ -0,0 +1,225 @@
+#include "Lexer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+namespace vm {
+    static constexpr size_t C_HASH_BLOCK = 16 * 1024;
+
+    enum CharClass : uint8_t {
+        C_OTHER = 0,
+        C_SPACE = 1,
+        C_LETTER = 2,
+        C_DIGIT = 4,
+        C_WORD = 8,     // letters, digits and '_'
+        C_NUMBER = 16   // everything that can continue an abstract literal
+    };
+
+    static constexpr std::array<uint8_t, 256> make_char_classes() {
+        std::array<uint8_t, 256> table {};
+        for(int c : {' ', '\t', '\n', '\r', '\v', '\f'}) {
+            table[c] = C_SPACE;
+        }
+        for(int c = 'a'; c <= 'z'; c++) {
+            table[c] = table[c - 'a' + 'A'] = C_LETTER | C_WORD | C_NUMBER;
+        }
+        for(int c = '0'; c <= '9'; c++) {
+            table[c] = C_DIGIT | C_WORD | C_NUMBER;
+        }
+        table['_'] = C_WORD | C_NUMBER;
+        table['#'] = table['.'] = C_NUMBER;
+        return table;
+    }
+
+    static constexpr std::array<uint8_t, 256> C_CHAR_CLASSES = make_char_classes();
+
+    static inline bool has_class(char c, uint8_t mask) {
+        return C_CHAR_CLASSES[static_cast<unsigned char>(c)] & mask;
+    }
+
+    // Keywords that can start a library unit or its context clause
+    static bool starts_unit_or_clause(std::string_view token) {
+        switch(fold_case(token[0])) {
+            case 'l': return iequals(token, "library");
+            case 'u': return iequals(token, "use");
+            case 'c': return iequals(token, "context") || iequals(token, "configuration");
+            case 'e': return iequals(token, "entity");
+            case 'a': return iequals(token, "architecture");
+            case 'p': return iequals(token, "package");
+            default: return false;
+        }
+    }
+
+    std::string to_lower(std::string_view token) {
+        std::string result(token);
+        for(char& c : result) {
+            c = fold_case(c);
+        }
+        return result;
+    }
+
+    // Copies the token to `out`, in lower case if it's folded, and returns the end
+    static inline char* copy_normalized(char* out, std::string_view token, bool fold) {
+        if(!fold) {
+            std::memcpy(out, token.data(), token.size());
+            return out + token.size();
+        }
+
+        for(char c : token) {
+            *out++ = fold_case(c);
+        }
+        return out;
+    }
+
+    Lexer::Lexer(std::string_view source) : source(source) { }
+
+    void Lexer::hash_block() {
+        hasher.update(source.substr(hashed, C_HASH_BLOCK));
+        hashed += C_HASH_BLOCK;
+    }
+
+    uint64_t Lexer::hash() {
+        while(hashed < source.size()) {
+            hash_block();
+        }
+        return hasher.digest();
+    }
+
+    void Lexer::skip_whitespace_and_comments() {
+        while(pos < source.size()) {
+            char c = source[pos];
+            if(has_class(c, C_SPACE)) {
+                pos++;
+            } else if(c == '-' && pos + 1 < source.size() && source[pos + 1] == '-') {
+                size_t end = source.find('\n', pos);
+                pos = end == std::string_view::npos ? source.size() : end + 1;
+            } else if(c == '/' && pos + 1 < source.size() && source[pos + 1] == '*') {
+                size_t end = source.find("*/", pos + 2);
+                pos = end == std::string_view::npos ? source.size() : end + 2;
+            } else if(c == '"') {
+                // String literal, "" is an escaped quote
+                size_t start = pos++;
+                while(pos < source.size()) {
+                    if(source[pos] == '"') {
+                        if(pos + 1 < source.size() && source[pos + 1] == '"') {
+                            pos += 2;
+                            continue;
+                        }
+                        pos++;
+                        break;
+                    }
+                    pos++;
+                }
+                append_normalized(source.substr(start, pos - start), false);
+            } else if(c == '\'' && pos + 2 < source.size() && source[pos + 2] == '\''
+                    && !(previous.size() > 0 && (has_class(previous.back(), C_WORD) || previous.back() == ')'))) {
+                // Character literal, a tick after a name or ')' is an attribute
+                append_normalized(source.substr(pos, 3), false);
+                pos += 3;
+            } else {
+                return;
+            }
+        }
+    }
+
+    std::string_view Lexer::next() {
+        skip_whitespace_and_comments();
+
+        while(hashed < source.size() && hashed <= pos) {
+            hash_block();
+        }
+
+        if(pos >= source.size()) {
+            cut(source.size());
+            return {};
+        }
+
+        size_t start = pos;
+        char c = source[pos];
+        bool fold = true;
+
+        if(has_class(c, C_LETTER)) {
+            // Identifier or keyword
+            while(pos < source.size() && has_class(source[pos], C_WORD)) {
+                pos++;
+            }
+
+            if(starts_unit_or_clause(source.substr(start, pos - start))) {
+                cut(start);
+            }
+        } else if(has_class(c, C_DIGIT)) {
+            // Abstract literal, including based literals like 16#FF#
+            while(pos < source.size() && has_class(source[pos], C_NUMBER)) {
+                pos++;
+            }
+        } else if(c == '\\') {
+            // Extended identifier, these are case sensitive
+            size_t end = source.find('\\', pos + 1);
+            pos = end == std::string_view::npos ? source.size() : end + 1;
+            fold = false;
+        } else {
+            pos++;
+        }
+
+        previous = source.substr(start, pos - start);
+        append_normalized(previous, fold);
+        return previous;
+    }
+
+    void Lexer::append_normalized(std::string_view token, bool fold) {
+        segment_size += token.size() + 1;
+
+        // Tokens are short, the buffer only runs full every few dozen of them
+        if(buffered + token.size() + 1 > sizeof(normalized)) {
+            flush_normalized();
+        }
+
+        // Long literals go through the buffer in pieces
+        while(token.size() + 1 > sizeof(normalized)) {
+            std::string_view piece = token.substr(0, sizeof(normalized));
+            copy_normalized(normalized, piece, fold);
+            buffered = piece.size();
+            flush_normalized();
+            token.remove_prefix(piece.size());
+        }
+
+        char* out = copy_normalized(normalized + buffered, token, fold);
+
+        // Keeps "a b" and "ab" apart
+        *out++ = ' ';
+        buffered = out - normalized;
+    }
+
+    void Lexer::flush_normalized() {
+        segment.update(std::string_view(normalized, buffered));
+        buffered = 0;
+    }
+
+    void Lexer::cut(size_t offset) {
+        // Only the segment before the first token can be empty, it would make
+        // a leading comment count
+        if(segment_size != 0) {
+            flush_normalized();
+            segments.push_back(Segment { segment_begin, segment.digest() });
+            segment = Hasher();
+            segment_size = 0;
+        }
+        segment_begin = offset;
+    }
+
+    uint64_t Lexer::normalized_hash(size_t begin, size_t end) {
+        while(!next().empty()) { }
+
+        auto it = std::lower_bound(segments.begin(), segments.end(), begin, [](const Segment& segment, size_t offset) {
+            return segment.begin < offset;
+        });
+
+        Hasher result;
+        for(; it != segments.end() && it->begin < end; it++) {
+            result.update(std::string_view(reinterpret_cast<const char*>(&it->hash), sizeof(it->hash)));
+        }
+        return result.digest();
+    }
+} // namespace vm
@@ -0,0 +1,85 @@
+#ifndef LEXER_HPP
+#define LEXER_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+#include "Hash.hpp"
+
+namespace vm {
+    // Single pass VHDL lexer. Tokens are views into the source, comments,
+    // string and character literals are skipped. The source is hashed block
+    // by block just ahead of the lexer, so every byte is only loaded once.
+    //
+    // Next to that the lexer hashes the normalized token stream: without
+    // comments and whitespace, identifiers and keywords in lower case, literals
+    // as they are. The stream is cut into segments at every token that can
+    // start a design unit or its context clause, so the parser can get the
+    // normalized hash of any unit after the fact.
+    class Lexer {
+    public:
+        explicit Lexer(std::string_view source);
+
+        // Returns the next token or an empty view at the end of the input
+        std::string_view next();
+
+        // Hash of the whole source, hashes the rest if the lexer stopped early
+        uint64_t hash();
+
+        // Normalized hash of the tokens from offset `begin` up to `end`. Both have to be
+        // 0, the end of the source or the offset of a library, use, context, entity,
+        // architecture, package or configuration token. Lexes the rest of the source.
+        uint64_t normalized_hash(size_t begin, size_t end);
+
+    private:
+        struct Segment {
+            size_t begin;
+            uint64_t hash;
+        };
+
+        void hash_block();
+        void skip_whitespace_and_comments();
+        void append_normalized(std::string_view token, bool fold);
+        void flush_normalized();
+        void cut(size_t offset);
+
+        std::string_view source;
+        std::string_view previous;
+        size_t pos = 0;
+        size_t hashed = 0;
+        Hasher hasher;
+
+        // Normalized tokens are folded into a small buffer and hashed in pieces
+        char normalized[256];
+        size_t buffered = 0;
+        Hasher segment;
+        size_t segment_size = 0;
+        size_t segment_begin = 0;
+        std::vector<Segment> segments;
+    };
+
+    inline char fold_case(char c) {
+        return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+    }
+
+    // Case insensitive compare against a lower case keyword, without allocating
+    inline bool iequals(std::string_view token, std::string_view keyword) {
+        if(token.size() != keyword.size()) {
+            return false;
+        }
+
+        for(size_t i = 0; i < token.size(); i++) {
+            if(fold_case(token[i]) != keyword[i]) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    std::string to_lower(std::string_view token);
+} // namespace vm
+
+#endif
@@ -1,72 +1,401 @@
 #include <iostream>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <cstdio>
 
 #include "Builder.hpp"
+#include "Options.hpp"
 #include "Unit.hpp"
 #include "DependencyGraph.hpp"
+#include "Watcher.hpp"
+#include "Constants.hpp"
+#include "Trace.hpp"
+#include "Cache.hpp"
+#include "Hash.hpp"
+#include "Utility.hpp"
 
 #define VHDLMAKE_VERSION "0.1.2"
 
 static void help() {
     std::cout << "List of commands:" << std::endl;
-    std::cout << "vhdlmake build [entity] - builds project and optionaly elaborates <entity>" << std::endl;
-    std::cout << "vhdlmake run <entity>   - builds project and runs <entity>"  << std::endl;
+    std::cout << "vhdlmake build [entity] - builds project, or only the files <entity> needs, and elaborates it" << std::endl;
+    std::cout << "vhdlmake run <entity>   - builds the files <entity> needs and runs it"  << std::endl;
     std::cout << "vhdlmake info <entity>  - show info for <entity>"  << std::endl;
     std::cout << "vhdlmake graph          - get dependency graph as mermaid url"  << std::endl;
     std::cout << "vhdlmake graph*         - get partial dependency graph as mermaid url (only updated files and deps)"  << std::endl;
-    std::cout << "vhdlmake subset         - get list of changed files and their dependencies"  << std::endl;
+    std::cout << "vhdlmake subset         - get list of files changed since the last build and their dependencies"  << std::endl;
+    std::cout << "vhdlmake watch [entity] - rebuild (and elaborate <entity>) whenever a file changes"  << std::endl;
+    std::cout << "vhdlmake test           - builds project and simulates all testbenches"  << std::endl;
+    std::cout << "vhdlmake ninja          - write a build.ninja for the project, if its structure changed"  << std::endl;
+    std::cout << "vhdlmake deps <unit>    - list the files <unit> (an entity, package or file) depends on"  << std::endl;
+    std::cout << "vhdlmake rdeps <unit>   - list the files that depend on <unit>"  << std::endl;
+    std::cout << "vhdlmake why <a> <b>    - show the shortest chain of design units from <a> to <b>"  << std::endl;
+    std::cout << "vhdlmake export <file>  - write the design unit graph to <file>, as .dot or .json"  << std::endl;
+    std::cout << std::endl << "Options:" << std::endl;
+    std::cout << "-j, --jobs <n>          - analyse up to <n> files at the same time (0 = one per core)"  << std::endl;
+    std::cout << "--batch <n>             - analyse up to <n> ready files with a single ghdl call"  << std::endl;
+    std::cout << "--paranoid              - rehash every file instead of trusting unchanged stat data"  << std::endl;
+    std::cout << "--no-store              - neither restore analysis results from ~/.cache/vhdlmake nor add to it"  << std::endl;
+    std::cout << "--run                   - watch: also run <entity> after every successful build"  << std::endl;
+    std::cout << "--since <rev>           - subset: start from the files changed since git revision <rev>"  << std::endl;
+    std::cout << "--trace <file>          - write a Chrome trace of all phases and commands to <file>"  << std::endl;
+    std::cout << "--tests <glob>          - test: simulate the entities matching <glob> instead of those without ports"  << std::endl;
+    std::cout << "--timeout <s>           - test: stop a simulation after <s> seconds, not counting elaboration"  << std::endl;
+    std::cout << "--report <file>         - test: write the results to <file>, as JUnit .xml or .json"  << std::endl;
+    std::cout << std::endl << "The simulator (ghdl or nvc), VHDL standard and flags are read from vhdlmake.json" << std::endl;
 }
 
+// Splits the command line into options and positional arguments
+static bool parse_options(int argc, char *argv[], vm::Options& options, std::vector<std::string>& args) {
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
 
-int main(int argc, char *argv[]) {
-    std::cerr << "vhdlmake v" << VHDLMAKE_VERSION;
+        if(arg == "-j" || arg == "--jobs" || (arg.starts_with("-j") && arg.size() > 2)) {
+            std::string value = arg.size() > 2 && arg[1] == 'j' ? arg.substr(2) : "";
+            if(value == "") {
+                if(i + 1 >= argc) {
+                    std::cout << "Missing value for " << arg << std::endl;
+                    return false;
+                }
+                value = argv[++i];
+            }
 
-    #ifdef DEBUG
-        std::cerr << " DEBUG BUILD " << std::endl;
-    #else
-        std::cerr << std::endl;
-    #endif
+            try {
+                options.jobs = std::stoi(value);
+            } catch(const std::exception&) {
+                std::cout << "Invalid number of jobs '" << value << "'" << std::endl;
+                return false;
+            }
 
-    if(argc < 2) {
-        help();
+            if(options.jobs <= 0) {
+                options.jobs = std::max(1u, std::thread::hardware_concurrency());
+            }
+        } else if(arg == "--batch") {
+            if(i + 1 >= argc) {
+                std::cout << "Missing value for " << arg << std::endl;
+                return false;
+            }
+
+            try {
+                options.batch = std::stoi(argv[++i]);
+            } catch(const std::exception&) {
+                std::cout << "Invalid batch size '" << argv[i] << "'" << std::endl;
+                return false;
+            }
+
+            if(options.batch <= 0) {
+                std::cout << "Batch size has to be at least 1" << std::endl;
+                return false;
+            }
+        } else if(arg == "--paranoid") {
+            options.paranoid = true;
+        } else if(arg == "--no-store") {
+            options.store = false;
+        } else if(arg == "--run") {
+            options.run = true;
+        } else if(arg == "--since") {
+            if(i + 1 >= argc) {
+                std::cout << "Missing value for " << arg << std::endl;
+                return false;
+            }
+            options.since = argv[++i];
+        } else if(arg == "--trace") {
+            if(i + 1 >= argc) {
+                std::cout << "Missing value for " << arg << std::endl;
+                return false;
+            }
+            options.trace = argv[++i];
+        } else if(arg == "--tests" || arg == "--report") {
+            if(i + 1 >= argc) {
+                std::cout << "Missing value for " << arg << std::endl;
+                return false;
+            }
+            (arg == "--tests" ? options.tests : options.report) = argv[++i];
+        } else if(arg == "--timeout") {
+            if(i + 1 >= argc) {
+                std::cout << "Missing value for " << arg << std::endl;
+                return false;
+            }
+
+            try {
+                options.timeout = std::stod(argv[++i]);
+            } catch(const std::exception&) {
+                std::cout << "Invalid timeout '" << argv[i] << "'" << std::endl;
+                return false;
+            }
+        } else {
+            args.push_back(arg);
+        }
+    }
+
+    return true;
+}
+
+// Keeps the graph in memory and rebuilds whenever a source file changes
+static int watch(vm::Builder& builder, vm::DependencyGraph& graph, const std::string& entity, const vm::Options& options) {
+    vm::Watcher watcher(".");
+    if(!watcher.is_open()) {
+        return EXIT_FAILURE;
+    }
+
+    bool first = true;
+    while(true) {
+        if(!first) {
+            std::cerr << "[WATCH] Waiting for changes" << std::endl;
+            auto changed = watcher.wait(std::chrono::milliseconds(vm::C_WATCH_DEBOUNCE_MS));
+            if(changed.empty()) {
+                continue;
+            }
+
+            for(const auto& path : changed) {
+                std::cerr << "[CHANGED] " << path << std::endl;
+            }
+            graph.update(changed);
+        }
+        first = false;
+
+        // Failed files stay in the partial DAG until they were built successfully,
+        // the ones that made it into the library don't have to be analysed again
+        vm::BuildPlan plan = graph.get_build_plan(entity);
+        if(builder.build(entity, plan, graph.is_elaborated(entity))) {
+            graph.record_durations(plan);
+            graph.commit(plan);
+            continue;
+        }
+
+        graph.record_durations(plan);
+        graph.record_elaboration(entity);
+        graph.commit(plan);
+        graph.save_cache();
+
+        if(options.run && entity != "") {
+            builder.run(entity);
+        }
+
+        // Watch mode only ends with a signal, so the trace is rewritten after every build
+        if(options.trace != "") {
+            vm::Trace::write(options.trace);
+        }
+    }
+}
+
+// Builds the project once and simulates all testbenches on the job pool
+static int run_tests(vm::Builder& builder, vm::DependencyGraph& graph, const vm::Options& options) {
+    const std::string& report = options.report;
+    if(report != "" && !report.ends_with(".xml") && !report.ends_with(".json")) {
+        std::cout << "Unknown format of " << report << ", use .xml or .json" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<vm::TestResult> tests;
+    for(const auto& entity : graph.get_testbenches(options.tests)) {
+        tests.push_back(vm::TestResult { .entity = entity, .elaborated = graph.is_elaborated(entity) });
+    }
+
+    if(tests.empty()) {
+        std::cerr << "[WARN] No testbenches found" << std::endl;
+    }
+
+    vm::BuildPlan plan = graph.get_build_plan();
+    if(builder.build("", plan)) {
+        return EXIT_FAILURE;
+    }
+
+    graph.record_durations(plan);
+    graph.commit(plan);
+
+    int ret = builder.test(tests);
+
+    for(const auto& test : tests) {
+        if(test.elaborated) {
+            graph.record_elaboration(test.entity);
+        }
+    }
+    graph.save_cache();
+
+    if(report != "") {
+        std::ofstream file(report);
+        if(report.ends_with(".xml")) {
+            vm::write_junit(file, tests);
+        } else {
+            vm::write_json(file, tests);
+        }
+
+        if(!file.good()) {
+            std::cerr << "[ERROR] Could not write " << report << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Writes build.ninja, unless the one there was generated from the same structure.
+// The first line holds a hash over the rest, which doesn't depend on file contents.
+static int write_ninja(vm::Builder& builder, vm::DependencyGraph& graph) {
+    std::error_code error;
+    std::filesystem::path self = std::filesystem::read_symlink("/proc/self/exe", error);
+    std::string regenerate = (error ? std::string("vhdlmake") : vm::shell_quote(self.string())) + " ninja";
+
+    std::ostringstream body;
+    if(!graph.write_ninja(body, builder.get_ninja_rules(regenerate))) {
+        return EXIT_FAILURE;
+    }
+
+    char header[64];
+    std::snprintf(header, sizeof(header), "# vhdlmake graph %016llx", static_cast<unsigned long long>(vm::hash64(body.str())));
+
+    const std::string path(vm::C_NINJA_FILE);
+    std::string first;
+    std::ifstream existing(path);
+    std::getline(existing, first);
+    if(first == header) {
+        std::cerr << "[INFO] " << path << " is up to date" << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    // Ninja may be reading the old one, so it is replaced in one step
+    {
+        std::ofstream file(path + ".tmp", std::ios::trunc);
+        file << header << "\n" << body.str();
+        if(!file.good()) {
+            std::cerr << "[ERROR] Could not write " << path << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::filesystem::rename(path + ".tmp", path, error);
+    if(error) {
+        std::cerr << "[ERROR] Could not write " << path << std::endl;
         return EXIT_FAILURE;
     }
 
-    std::string command = argv[1];
+    std::cerr << "[INFO] Wrote " << path << std::endl;
+    return EXIT_SUCCESS;
+}
+
+// Queries are answered from the graph of the last build, which the cache already holds
+static vm::DependencyGraph load_graph(const vm::Options& options) {
+    vm::Cache cache {std::string(vm::C_CACHE_FILE)};
+    if(cache.size() == 0) {
+        std::cerr << "[INFO] No cache yet, scanning the project" << std::endl;
+        return vm::DependencyGraph(options);
+    }
+
+    return vm::DependencyGraph(cache.get_units(), {}, options);
+}
+
+static int query(const std::string& command, const std::vector<std::string>& args, const vm::Options& options) {
+    size_t needed = command == "why" ? 3 : 2;
+    if(args.size() != needed) {
+        std::cout << "Please provide " << (needed == 3 ? "two units" : command == "export" ? "a file" : "a unit") << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    vm::DependencyGraph graph = load_graph(options);
+
+    if(command == "export") {
+        const std::string& path = args[1];
+        bool json = path.ends_with(".json");
+        if(!json && !path.ends_with(".dot")) {
+            std::cout << "Unknown format of " << path << ", use .dot or .json" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        std::ofstream file(path);
+        if(json) {
+            graph.write_json(file);
+        } else {
+            graph.write_dot(file);
+        }
+
+        if(!file.good()) {
+            std::cerr << "[ERROR] Could not write " << path << std::endl;
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    for(size_t i = 1; i < args.size(); i++) {
+        if(!graph.contains(args[i])) {
+            std::cout << "Unknown design unit or file '" << args[i] << "'" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(command == "why") {
+        auto chain = graph.get_path(args[1], args[2]);
+        if(chain.empty()) {
+            std::cout << args[1] << " doesn't depend on " << args[2] << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        for(size_t i = 0; i < chain.size(); i++) {
+            std::cout << std::string(2 * i, ' ') << chain[i] << std::endl;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    for(const auto& path : graph.get_dependencies(args[1], command == "rdeps")) {
+        std::cout << path << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
+
+static int execute(const vm::Options& options, const std::vector<std::string>& args) {
+    std::string command = args[0];
     std::string entity;
 
-    if(argc > 2) {
-        entity = argv[2];
+    if(args.size() > 1) {
+        entity = args[1];
     }
 
+    // Neither needs a scan nor the build directories
+    if(command == "deps" || command == "rdeps" || command == "why" || command == "export") {
+        return query(command, args, options);
+    }
 
-    vm::Builder builder;
-    vm::DependencyGraph graph;
+    vm::Builder builder(options);
+    vm::DependencyGraph graph(options);
 
     if(command == "build") {
-        if(builder.build(entity, graph.get_update_list())) {
+        vm::BuildPlan plan = graph.get_build_plan(entity);
+        if(builder.build(entity, plan, graph.is_elaborated(entity))) {
             return EXIT_FAILURE;
         }
 
+        graph.record_durations(plan);
+        graph.record_elaboration(entity);
+        graph.commit(plan);
         graph.save_cache();
     } else if (command == "run") {
-        if(argc != 3) {
+        if(args.size() != 2) {
             std::cout << "Please provide an entity to run" << std::endl;
             return EXIT_FAILURE;
         }
 
-        if(builder.build(entity, graph.get_update_list())) {
+        vm::BuildPlan plan = graph.get_build_plan(entity);
+        if(builder.build(entity, plan, graph.is_elaborated(entity))) {
             return EXIT_FAILURE;
         }
 
+        // Saved before simulating, a failing testbench doesn't make the build invalid
+        graph.record_durations(plan);
+        graph.record_elaboration(entity);
+        graph.commit(plan);
+        graph.save_cache();
+
         if(builder.run(entity)) {
             return EXIT_FAILURE;
         }
-
-        graph.save_cache();
     } else if(command == "clean") {
         return builder.clean();
     } else if (command == "info") {
-        if(argc != 3) {
+        if(args.size() != 2) {
             std::cout << "Please provide a file to show info for" << std::endl;
             return EXIT_FAILURE;
         }
@@ -78,6 +407,12 @@ int main(int argc, char *argv[]) {
        std::cout << graph.get_mermaid_url(false) << std::endl;
     } else if(command == "graph*") {
        std::cout << graph.get_mermaid_url(true) << std::endl;
+    } else if(command == "watch") {
+        return watch(builder, graph, entity, options);
+    } else if(command == "test") {
+        return run_tests(builder, graph, options);
+    } else if(command == "ninja") {
+        return write_ninja(builder, graph);
     } else if(command == "subset") {
         for(const auto& changed : graph.get_minimal_subset()) {
             std::cout << changed << " ";
@@ -88,4 +423,41 @@ int main(int argc, char *argv[]) {
     }
 
     return EXIT_SUCCESS;
-}  
\ No newline at end of file
+}
+
+int main(int argc, char *argv[]) {
+    std::cerr << "vhdlmake v" << VHDLMAKE_VERSION;
+
+    #ifdef DEBUG
+        std::cerr << " DEBUG BUILD " << std::endl;
+    #else
+        std::cerr << std::endl;
+    #endif
+
+    vm::Options options;
+    std::vector<std::string> args;
+
+    if(!parse_options(argc, argv, options, args) || args.size() < 1) {
+        help();
+        return EXIT_FAILURE;
+    }
+
+    if(!vm::Backend::load(std::string(vm::C_CONFIG_FILE), options.backend)) {
+        return EXIT_FAILURE;
+    }
+
+    if(options.trace != "") {
+        vm::Trace::enable();
+    }
+
+    int ret = execute(options, args);
+
+    if(options.trace != "") {
+        vm::Trace::print_summary();
+        if(!vm::Trace::write(options.trace)) {
+            std::cerr << "[ERROR] Could not write trace to " << options.trace << std::endl;
+        }
+    }
+
+    return ret;
+}
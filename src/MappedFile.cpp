@@ -0,0 +1,42 @@
+#include "MappedFile.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace vm {
+    MappedFile::MappedFile(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0) {
+            return;
+        }
+
+        struct stat st;
+        if(fstat(fd, &st) != 0) {
+            close(fd);
+            return;
+        }
+
+        // mmap can't map empty files, but an empty view is just as good
+        open = true;
+        if(st.st_size > 0) {
+            void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(addr == MAP_FAILED) {
+                open = false;
+            } else {
+                data = static_cast<const char*>(addr);
+                size = st.st_size;
+                madvise(addr, size, MADV_SEQUENTIAL);
+            }
+        }
+
+        close(fd);
+    }
+
+    MappedFile::~MappedFile() {
+        if(data != nullptr) {
+            munmap(const_cast<char*>(data), size);
+        }
+    }
+} // namespace vm
@@ -0,0 +1,27 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <string>
+#include <string_view>
+
+namespace vm {
+    // Read-only memory mapping of a whole file
+    class MappedFile {
+    public:
+        explicit MappedFile(const std::string& path);
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool is_open() const { return open; }
+        std::string_view view() const { return std::string_view(data, size); }
+
+    private:
+        const char* data = nullptr;
+        size_t size = 0;
+        bool open = false;
+    };
+} // namespace vm
+
+#endif
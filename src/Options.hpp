@@ -0,0 +1,45 @@
+#ifndef OPTIONS_HPP
+#define OPTIONS_HPP
+
+#include "Backend.hpp"
+
+#include <string>
+
+namespace vm {
+    struct Options {
+        // Number of analysis jobs that may run at the same time
+        int jobs = 1;
+
+        // Maximum number of ready files analysed by a single ghdl call
+        int batch = 1;
+
+        // Rehash every file, even if its stat data matches the cache
+        bool paranoid = false;
+
+        // Restore analysis results from the artifact store and add new ones to it
+        bool store = true;
+
+        // Run the entity after every successful build in watch mode
+        bool run = false;
+
+        // subset: use the files changed since this git revision instead of the cache
+        std::string since;
+
+        // Write a Chrome trace of all phases and commands to this file
+        std::string trace;
+
+        // test: simulate the entities matching this glob instead of those without ports
+        std::string tests;
+
+        // test: stop a testbench after this many seconds, 0 for no limit
+        double timeout = 0;
+
+        // test: write the results to this file, as JUnit XML or JSON depending on its extension
+        std::string report;
+
+        // Simulator and its flags, from vhdlmake.json
+        Backend backend;
+    };
+} // namespace vm
+
+#endif
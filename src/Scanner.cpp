@@ -0,0 +1,223 @@
+#include "Scanner.hpp"
+#include "Constants.hpp"
+#include "Hash.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+namespace vm {
+    // Record layout of getdents64, glibc doesn't declare it
+    struct LinuxDirent64 {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[1];
+    };
+
+    static std::string join(const std::string& directory, std::string_view name) {
+        return directory.empty() ? std::string(name) : directory + "/" + std::string(name);
+    }
+
+    static int64_t mtime_of(int fd) {
+        struct stat st;
+        if(fstat(fd, &st) != 0) {
+            return 0;
+        }
+        return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    }
+
+    bool is_source_file(std::string_view name) {
+        return name.ends_with(".vhdl") || name.ends_with(".vhd");
+    }
+
+    IgnoreRules::IgnoreRules() {
+        add(".git/");
+        add(std::string(C_VCD_DIRECTORY) + "/");
+        add(std::string(C_JOB_DIRECTORY) + "/");
+    }
+
+    void IgnoreRules::add(std::string_view line) {
+        while(!line.empty() && (line.back() == ' ' || line.back() == '\t' || line.back() == '\r')) {
+            line.remove_suffix(1);
+        }
+        if(line.empty() || line.front() == '#') {
+            return;
+        }
+
+        Rule rule { .anchored = false, .directory_only = false };
+        if(line.back() == '/') {
+            rule.directory_only = true;
+            line.remove_suffix(1);
+        }
+
+        rule.anchored = line.find('/') != std::string_view::npos;
+        if(line.starts_with("/")) {
+            line.remove_prefix(1);
+        }
+
+        if(!line.empty()) {
+            rule.pattern = line;
+            rules.push_back(std::move(rule));
+        }
+    }
+
+    void IgnoreRules::load(const std::string& path) {
+        std::ifstream file(path);
+        if(!file.is_open()) {
+            return;
+        }
+
+        std::stringstream content;
+        content << file.rdbuf();
+        content_hash = hash64(content.str());
+
+        std::string line;
+        while(std::getline(content, line)) {
+            add(line);
+        }
+    }
+
+    bool IgnoreRules::matches(const std::string& path, bool directory) const {
+        size_t slash = path.rfind('/');
+        const char* name = path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+
+        for(const auto& rule : rules) {
+            if(rule.directory_only && !directory) {
+                continue;
+            }
+
+            const char* subject = rule.anchored ? path.c_str() : name;
+            if(fnmatch(rule.pattern.c_str(), subject, FNM_PATHNAME) == 0) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    Scanner::Scanner(const std::string& root) : root(root), buffer(64 * 1024) {
+        ignore.load(root + "/" + std::string(C_IGNORE_FILE));
+    }
+
+    std::vector<std::string> Scanner::scan(const DirectorySnapshot& previous) {
+        Trace::Scope scope("scan");
+
+        timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        snapshot = DirectorySnapshot {
+            .scanned_at = static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec,
+            .ignore_hash = ignore.hash()
+        };
+
+        std::vector<std::string> paths;
+        int fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if(fd < 0) {
+            std::cerr << "[ERROR] Could not open directory " << root << std::endl;
+            return paths;
+        }
+
+        // Listings of another rule set don't say anything about this one
+        static const DirectorySnapshot none;
+        walk(fd, "", previous.ignore_hash == snapshot.ignore_hash ? previous : none, paths);
+        close(fd);
+
+        // Sorted so the result doesn't depend on the file system
+        std::sort(paths.begin(), paths.end());
+        std::sort(snapshot.directories.begin(), snapshot.directories.end(), [](const auto& a, const auto& b) {
+            return a.path < b.path;
+        });
+
+        Trace::count(Trace::FILES_SCANNED, paths.size());
+        return paths;
+    }
+
+    void Scanner::walk(int fd, const std::string& path, const DirectorySnapshot& previous, std::vector<std::string>& paths) {
+        ScannedDirectory directory { .path = path, .mtime = mtime_of(fd) };
+
+        auto it = std::lower_bound(previous.directories.begin(), previous.directories.end(), path, [](const auto& d, const std::string& p) {
+            return d.path < p;
+        });
+        bool known = it != previous.directories.end() && it->path == path;
+
+        if(known && directory.mtime != 0 && it->mtime == directory.mtime
+                && directory.mtime < previous.scanned_at - C_MTIME_SLACK_NS) {
+            directory.files = it->files;
+            directory.directories = it->directories;
+            Trace::count(Trace::DIRECTORIES_REUSED);
+        } else {
+            read_directory(fd, directory);
+        }
+
+        for(const auto& file : directory.files) {
+            paths.push_back(join(path, file));
+        }
+
+        std::vector<std::string> children = directory.directories;
+        snapshot.directories.push_back(std::move(directory));
+
+        for(const auto& child : children) {
+            int child_fd = openat(fd, child.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if(child_fd < 0) {
+                continue;
+            }
+
+            walk(child_fd, join(path, child), previous, paths);
+            close(child_fd);
+        }
+    }
+
+    void Scanner::read_directory(int fd, ScannedDirectory& directory) {
+        while(true) {
+            long length = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+            if(length <= 0) {
+                return;
+            }
+
+            for(long offset = 0; offset < length; ) {
+                const auto* entry = reinterpret_cast<const LinuxDirent64*>(buffer.data() + offset);
+                offset += entry->d_reclen;
+
+                std::string_view name = entry->d_name;
+                if(name == "." || name == "..") {
+                    continue;
+                }
+
+                // Some file systems don't fill in the type
+                unsigned char type = entry->d_type;
+                if(type == DT_UNKNOWN) {
+                    struct stat st;
+                    if(fstatat(fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                        continue;
+                    }
+                    type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : S_ISLNK(st.st_mode) ? DT_LNK : DT_UNKNOWN;
+                }
+
+                // Like before, linked files are sources but linked directories are not followed
+                if(type == DT_DIR) {
+                    if(!ignore.matches(join(directory.path, name), true)) {
+                        directory.directories.emplace_back(name);
+                    }
+                } else if((type == DT_REG || type == DT_LNK) && is_source_file(name)
+                        && !ignore.matches(join(directory.path, name), false)) {
+                    directory.files.emplace_back(name);
+                }
+            }
+        }
+    }
+
+    std::vector<std::string> scan_sources(const std::string& directory) {
+        return Scanner(directory).scan();
+    }
+} // namespace vm
@@ -0,0 +1,86 @@
+#ifndef SCANNER_HPP
+#define SCANNER_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+namespace vm {
+    // True for names ending in .vhdl or .vhd
+    bool is_source_file(std::string_view name);
+
+    // Patterns of a .vhdlmakeignore file, one per line. A pattern containing a
+    // slash is matched against the path relative to the project root, any other
+    // one against the name only. A trailing slash restricts it to directories.
+    // Wildcards are the ones of fnmatch(3), lines starting with # are comments.
+    class IgnoreRules {
+    public:
+        // Always contains the rules for .git, simulation output and job directories
+        IgnoreRules();
+
+        // Adds the rules of the file if it exists
+        void load(const std::string& path);
+
+        bool matches(const std::string& path, bool directory) const;
+        uint64_t hash() const { return content_hash; }
+
+    private:
+        struct Rule {
+            std::string pattern;
+            bool anchored;
+            bool directory_only;
+        };
+
+        void add(std::string_view line);
+
+        std::vector<Rule> rules;
+        uint64_t content_hash = 0;
+    };
+
+    // A file or directory changed within this time before the previous scan may
+    // have changed again without a new mtime, so its cached state is not trusted
+    constexpr int64_t C_MTIME_SLACK_NS = 1000000000;
+
+    // What a scan found in one directory, names only
+    struct ScannedDirectory {
+        std::string path;       // relative to the root, empty for the root itself
+        int64_t mtime = 0;
+        std::vector<std::string> files;
+        std::vector<std::string> directories;
+    };
+
+    // All directories of a scan, sorted by path
+    struct DirectorySnapshot {
+        int64_t scanned_at = 0;
+        uint64_t ignore_hash = 0;
+        std::vector<ScannedDirectory> directories;
+    };
+
+    // Finds all vhdl sources below a directory with openat and getdents64. A
+    // directory whose mtime didn't change since the previous scan has the same
+    // entries, so its listing is taken from the snapshot instead of read again.
+    class Scanner {
+    public:
+        explicit Scanner(const std::string& root);
+
+        // Returns the paths of all sources relative to the root, sorted
+        std::vector<std::string> scan(const DirectorySnapshot& previous = {});
+
+        const DirectorySnapshot& get_snapshot() const { return snapshot; }
+
+    private:
+        void walk(int fd, const std::string& path, const DirectorySnapshot& previous, std::vector<std::string>& paths);
+        void read_directory(int fd, ScannedDirectory& directory);
+
+        std::string root;
+        IgnoreRules ignore;
+        DirectorySnapshot snapshot;
+        std::vector<char> buffer;
+    };
+
+    // Returns the paths of all vhdl files below `directory`, relative to it and sorted
+    std::vector<std::string> scan_sources(const std::string& directory);
+} // namespace vm
+
+#endif
@@ -0,0 +1,80 @@
+#include "TestReport.hpp"
+#include "Utility.hpp"
+
+namespace vm {
+    const char* status_name(TestStatus status) {
+        switch(status) {
+            case TestStatus::PASSED: return "passed";
+            case TestStatus::FAILED: return "failed";
+            case TestStatus::TIMEOUT: return "timeout";
+            case TestStatus::ERROR: return "error";
+        }
+        return "error";
+    }
+
+    static std::string xml_escape(std::string_view text) {
+        std::string escaped;
+        for(char c : text) {
+            switch(c) {
+                case '<': escaped += "&lt;"; break;
+                case '>': escaped += "&gt;"; break;
+                case '&': escaped += "&amp;"; break;
+                case '"': escaped += "&quot;"; break;
+                default:
+                    // XML 1.0 doesn't allow other control characters, not even escaped
+                    if(static_cast<unsigned char>(c) >= 0x20 || c == '\n' || c == '\t') {
+                        escaped += c;
+                    }
+            }
+        }
+        return escaped;
+    }
+
+    void write_junit(std::ostream& stream, const std::vector<TestResult>& results) {
+        size_t failures = 0;
+        size_t errors = 0;
+        double total = 0;
+        for(const auto& result : results) {
+            // Timeouts count as errors, the test didn't get to a verdict
+            failures += result.status == TestStatus::FAILED;
+            errors += result.status == TestStatus::TIMEOUT || result.status == TestStatus::ERROR;
+            total += result.seconds;
+        }
+
+        stream << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+        stream << "<testsuites tests=\"" << results.size() << "\" failures=\"" << failures << "\" errors=\"" << errors
+               << "\" time=\"" << total << "\">\n";
+        stream << "  <testsuite name=\"vhdlmake\" tests=\"" << results.size() << "\" failures=\"" << failures
+               << "\" errors=\"" << errors << "\" time=\"" << total << "\">\n";
+
+        for(const auto& result : results) {
+            stream << "    <testcase name=\"" << xml_escape(result.entity) << "\" classname=\"work\" time=\"" << result.seconds << "\">\n";
+            if(result.status == TestStatus::FAILED) {
+                stream << "      <failure message=\"simulation failed\"/>\n";
+            } else if(result.status == TestStatus::TIMEOUT) {
+                stream << "      <error message=\"timed out\"/>\n";
+            } else if(result.status == TestStatus::ERROR) {
+                stream << "      <error message=\"elaboration failed\"/>\n";
+            }
+
+            if(!result.output.empty()) {
+                stream << "      <system-out>" << xml_escape(result.output) << "</system-out>\n";
+            }
+            stream << "    </testcase>\n";
+        }
+
+        stream << "  </testsuite>\n";
+        stream << "</testsuites>\n";
+    }
+
+    void write_json(std::ostream& stream, const std::vector<TestResult>& results) {
+        stream << "{\"tests\": [";
+        for(size_t i = 0; i < results.size(); i++) {
+            const TestResult& result = results[i];
+            stream << (i == 0 ? "\n" : ",\n");
+            stream << "  {\"name\": " << json_quote(result.entity) << ", \"status\": \"" << status_name(result.status)
+                   << "\", \"time\": " << result.seconds << ", \"output\": " << json_quote(result.output) << "}";
+        }
+        stream << "\n]}\n";
+    }
+} // namespace vm
@@ -0,0 +1,39 @@
+#ifndef TEST_REPORT_HPP
+#define TEST_REPORT_HPP
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <cstdint>
+
+namespace vm {
+    enum class TestStatus : uint8_t {
+        PASSED = 0,
+        FAILED,     // the simulation exited with an error
+        TIMEOUT,
+        ERROR       // the testbench couldn't be elaborated
+    };
+
+    const char* status_name(TestStatus status);
+
+    struct TestResult {
+        std::string entity;
+
+        // Set before the run if the binary is up to date, afterwards if it was elaborated
+        bool elaborated = false;
+
+        TestStatus status = TestStatus::ERROR;
+        double seconds = 0;
+
+        // Everything the elaboration and the simulation wrote
+        std::string output;
+    };
+
+    // JUnit XML as understood by most CI servers, one test suite for the project
+    void write_junit(std::ostream& stream, const std::vector<TestResult>& results);
+
+    // {"tests": [{"name": ..., "status": ..., "time": ..., "output": ...}]}
+    void write_json(std::ostream& stream, const std::vector<TestResult>& results);
+} // namespace vm
+
+#endif
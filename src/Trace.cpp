@@ -0,0 +1,170 @@
+#include "Trace.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+using json = nlohmann::json;
+
+namespace vm {
+    namespace {
+        struct Event {
+            std::string name;
+            std::string category;
+            int64_t start;      // microseconds since Trace::enable
+            int64_t duration;
+            uint32_t thread;
+        };
+
+        std::mutex mutex;
+        std::vector<Event> events;
+        std::chrono::steady_clock::time_point origin;
+        std::atomic<uint32_t> thread_count = 0;
+
+        // Lanes are shown after the threads in the trace viewer
+        constexpr uint32_t C_FIRST_LANE = 100;
+
+        // Small sequential ids read better in the trace viewer than the native ones
+        uint32_t thread_id() {
+            thread_local uint32_t id = thread_count++;
+            return id;
+        }
+
+        int64_t microseconds(std::chrono::steady_clock::duration duration) {
+            return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+        }
+
+        const char* counter_name(Trace::Counter counter) {
+            switch(counter) {
+                case Trace::FILES_SCANNED: return "files scanned";
+                case Trace::FILES_REHASHED: return "files rehashed";
+                case Trace::BYTES_READ: return "bytes read";
+                case Trace::PARTIAL_DAG_NODES: return "partial dag nodes";
+                case Trace::DIRECTORIES_REUSED: return "directories reused";
+                case Trace::ARTIFACTS_RESTORED: return "artifacts restored";
+                case Trace::ARTIFACTS_STORED: return "artifacts stored";
+                default: return "";
+            }
+        }
+    } // namespace
+
+    void Trace::Scope::begin(std::string_view name, std::string_view category) {
+        this->name = name;
+        this->category = category;
+        start = std::chrono::steady_clock::now();
+        active = true;
+    }
+
+    void Trace::Scope::end() {
+        auto now = std::chrono::steady_clock::now();
+        Event event { std::move(name), std::move(category), microseconds(start - origin), microseconds(now - start), thread_id() };
+
+        std::lock_guard<std::mutex> lock(mutex);
+        events.push_back(std::move(event));
+    }
+
+    void Trace::add(std::string_view name, std::string_view category,
+                    std::chrono::steady_clock::time_point start, uint32_t lane) {
+        auto now = std::chrono::steady_clock::now();
+        Event event { std::string(name), std::string(category), microseconds(start - origin), microseconds(now - start), C_FIRST_LANE + lane };
+
+        std::lock_guard<std::mutex> lock(mutex);
+        events.push_back(std::move(event));
+    }
+
+    void Trace::enable() {
+        origin = std::chrono::steady_clock::now();
+        thread_id();
+        enabled = true;
+    }
+
+    bool Trace::write(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        json trace;
+        trace["displayTimeUnit"] = "ms";
+        json& list = trace["traceEvents"];
+        list = json::array();
+
+        for(const auto& event : events) {
+            list.push_back({
+                {"name", event.name}, {"cat", event.category}, {"ph", "X"},
+                {"ts", event.start}, {"dur", event.duration}, {"pid", 1}, {"tid", event.thread}
+            });
+        }
+
+        // Counters are only known at the end, show them as one sample there
+        json args;
+        for(int counter = 0; counter < COUNTER_COUNT; counter++) {
+            args[counter_name(Counter(counter))] = counters[counter].load();
+        }
+        list.push_back({
+            {"name", "counters"}, {"ph", "C"}, {"pid", 1}, {"tid", 0},
+            {"ts", microseconds(std::chrono::steady_clock::now() - origin)}, {"args", args}
+        });
+
+        std::ofstream file(path, std::ios::trunc);
+        if(!file.is_open()) {
+            return false;
+        }
+
+        file << trace.dump() << std::endl;
+        return file.good();
+    }
+
+    void Trace::print_summary() {
+        struct Total {
+            std::string name;
+            size_t count = 0;
+            int64_t duration = 0;
+            int64_t longest = 0;
+            std::string slowest;
+        };
+
+        std::vector<Total> totals;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            // Phases are listed by name, commands are grouped by their category
+            for(const auto& event : events) {
+                const std::string& key = event.category == "phase" ? event.name : event.category;
+                auto it = std::find_if(totals.begin(), totals.end(), [&](const Total& t) { return t.name == key; });
+                if(it == totals.end()) {
+                    totals.push_back({key});
+                    it = totals.end() - 1;
+                }
+
+                it->count++;
+                it->duration += event.duration;
+                if(it->count == 1 || event.duration > it->longest) {
+                    it->longest = event.duration;
+                    it->slowest = event.name;
+                }
+            }
+        }
+
+        std::cerr << std::fixed << std::setprecision(1);
+        for(const auto& total : totals) {
+            std::cerr << "[TRACE] " << std::left << std::setw(18) << total.name << std::right
+                      << std::setw(10) << total.duration / 1000.0 << " ms";
+            if(total.count > 1) {
+                std::cerr << " in " << total.count << " calls";
+            }
+            if(total.slowest != total.name) {
+                std::cerr << ", slowest " << total.slowest << " (" << total.longest / 1000.0 << " ms)";
+            }
+            std::cerr << std::endl;
+        }
+        std::cerr << std::defaultfloat;
+
+        for(int counter = 0; counter < COUNTER_COUNT; counter++) {
+            std::cerr << "[TRACE] " << std::left << std::setw(18) << counter_name(Counter(counter)) << std::right
+                      << std::setw(10) << counters[counter].load() << std::endl;
+        }
+    }
+} // namespace vm
@@ -0,0 +1,94 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace vm {
+    // Records the wall time of phases and external commands as a Chrome trace
+    // that can be opened in chrome://tracing or ui.perfetto.dev. Tracing is off
+    // by default, then every scope and counter costs a single branch.
+    class Trace {
+    public:
+        enum Counter {
+            FILES_SCANNED,
+            FILES_REHASHED,
+            BYTES_READ,
+            PARTIAL_DAG_NODES,
+            DIRECTORIES_REUSED,
+            ARTIFACTS_RESTORED,
+            ARTIFACTS_STORED,
+            COUNTER_COUNT
+        };
+
+        // Times the enclosing block, `category` groups the events in the summary
+        class Scope {
+        public:
+            explicit Scope(std::string_view name, std::string_view category = "phase") {
+                if(enabled) {
+                    begin(name, category);
+                }
+            }
+
+            ~Scope() {
+                if(active) {
+                    end();
+                }
+            }
+
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+        private:
+            void begin(std::string_view name, std::string_view category);
+            void end();
+
+            bool active = false;
+            std::string name;
+            std::string category;
+            std::chrono::steady_clock::time_point start;
+        };
+
+        // Records an event that ended now but doesn't belong to a scope, like a
+        // process observed by an event loop. Events of one lane share a row.
+        static void record(std::string_view name, std::string_view category,
+                           std::chrono::steady_clock::time_point start, uint32_t lane) {
+            if(enabled) {
+                add(name, category, start, lane);
+            }
+        }
+
+        static void enable();
+        static bool is_enabled() { return enabled; }
+
+        static void count(Counter counter, uint64_t value = 1) {
+            if(enabled) {
+                counters[counter] += value;
+            }
+        }
+
+        static void set(Counter counter, uint64_t value) {
+            if(enabled) {
+                counters[counter] = value;
+            }
+        }
+
+        // Writes all events recorded so far, returns false if the file couldn't be written
+        static bool write(const std::string& path);
+
+        // Prints the time spent per phase and command category and all counters to stderr
+        static void print_summary();
+
+    private:
+        static void add(std::string_view name, std::string_view category,
+                        std::chrono::steady_clock::time_point start, uint32_t lane);
+
+        static inline bool enabled = false;
+        static inline std::atomic<uint64_t> counters[COUNTER_COUNT] {};
+    };
+} // namespace vm
+
+#endif
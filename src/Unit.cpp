@@ -1,133 +1,302 @@
 #include "Unit.hpp"
-#include <fstream>
-#include <sstream>
-#include <algorithm>
+#include "Lexer.hpp"
+#include "MappedFile.hpp"
+#include "Trace.hpp"
+
+#include <string_view>
+#include <array>
 #include <iostream>
+#include <sys/stat.h>
 
 namespace vm {
 
     enum class ParserState {
         TOP_LEVEL = 0,
-        ENTITY_DECL, 
+        ENTITY_DECL,
         PACKAGE_DECL,
+        PACKAGE_BODY,
         ARCH_DECL,
-        ARCH_STATE,
-        PROCEDURE_DECL,
-        PROCEDURE_BODY
+        CONFIG_DECL
     };
 
-    static std::stringstream read_file(const std::string& path) {
-        std::ifstream file(path);
-        std::stringstream buffer;
-        buffer << file.rdbuf();
-        file.close();
-        return buffer;
+    // Libraries that are shipped with the simulator
+    static bool is_standard_library(std::string_view library) {
+        return iequals(library, "ieee") || iequals(library, "std");
     }
 
-    static std::vector<std::string> tokenize(std::stringstream& stream) {
-        std::vector<std::string> tokens;
-        std::string tmp;
-        while(stream >> tmp) {
-            std::transform(tmp.begin(), tmp.end(), tmp.begin(), ::tolower);
-            tokens.emplace_back(tmp);
+    // Small window over the lexer, so the parser can look a few tokens ahead
+    // without collecting the whole file first
+    class TokenStream {
+    public:
+        explicit TokenStream(Lexer& lexer) : lexer(lexer) { }
+
+        // Token k positions after the current one, empty past the end
+        std::string_view peek(size_t k = 0) {
+            while(count <= k) {
+                window[(head + count) % window.size()] = lexer.next();
+                count++;
+            }
+            return window[(head + k) % window.size()];
+        }
+
+        std::string_view next() {
+            std::string_view token = peek();
+            head = (head + 1) % window.size();
+            count--;
+            previous = token;
+            return token;
+        }
+
+        std::string_view last() const { return previous; }
+
+    private:
+        Lexer& lexer;
+        std::array<std::string_view, 8> window;
+        std::string_view previous;
+        size_t head = 0;
+        size_t count = 0;
+    };
+
+    // Reads a selected name like work.pkg.all and returns its parts
+    static std::vector<std::string_view> selected_name(TokenStream& stream) {
+        std::vector<std::string_view> parts { stream.next() };
+        while(stream.peek() == "." && !stream.peek(1).empty()) {
+            stream.next();
+            parts.push_back(stream.next());
         }
-        return tokens;
+        return parts;
     }
 
-    static std::string parse_reference(const std::string& ref) {
-        size_t first = 0;
-        size_t last = 0;
-        for(size_t i = 0; i < ref.length(); i++) {
-            if(ref[i] == '.' && first == 0) {
-                first = i + 1;
-            } else if(!isalpha(ref[i]) && ref[i] != '_') {
-                last = i;
-                break;
+    static void parse_use_clause(TokenStream& stream, std::unordered_set<std::string>& references) {
+        while(!stream.peek().empty()) {
+            // Binding indications in configurations, e.g. use entity work.foo(rtl);
+            bool binding = iequals(stream.peek(), "entity") || iequals(stream.peek(), "configuration");
+            if(binding) {
+                stream.next();
             }
-        }
 
-        if(first == 0 && last == 0) {
-            return ref;
-        } 
+            auto parts = selected_name(stream);
+            if(parts.size() >= 2 && !is_standard_library(parts[0])) {
+                std::string_view name = binding ? parts.back() : parts[1];
+                if(!iequals(name, "all")) {
+                    references.emplace(to_lower(name));
+                }
+            }
 
-        return ref.substr(first, last - first);
+            if(stream.peek() != ",") {
+                return;
+            }
+            stream.next();
+        }
     }
 
-    Unit Unit::from_file(const std::string& path) {
-        static std::hash<std::string> hasher; 
-        std::stringstream buffer = read_file(path);
-        
-        Unit unit {
-            .path = path,
-            .hash = hasher(buffer.str())
+    static void parse(std::string_view source, Lexer& lexer, TokenStream& stream, Unit& unit) {
+        ParserState state = ParserState::TOP_LEVEL;
+
+        // Library, use and context clauses either belong to the current unit or form
+        // the context clause of the next one. That is only known at the token after them,
+        // until then their references are kept aside.
+        std::unordered_set<std::string> pending;
+        bool in_clause = false;
+        size_t clause_begin = 0;
+        std::vector<size_t> begins;
+
+        auto references = [&]() -> std::unordered_set<std::string>& {
+            return in_clause || unit.design_units.empty() ? pending : unit.design_units.back().references;
         };
 
-        std::vector<std::string> tokens = tokenize(buffer);
-        if(tokens.size() == 0) { return unit; }
+        auto start_clause = [&](std::string_view token) {
+            if(!in_clause) {
+                clause_begin = token.data() - source.data();
+                in_clause = true;
+            }
+        };
 
+        auto begin_unit = [&](UnitKind kind, std::string name, std::string_view token) {
+            begins.push_back(in_clause ? clause_begin : token.data() - source.data());
+            unit.design_units.push_back(DesignUnit { .kind = kind, .name = std::move(name), .references = std::move(pending) });
+            pending.clear();
+            in_clause = false;
+        };
 
-        ParserState state = ParserState::TOP_LEVEL;
-        for(int i = 0; i < tokens.size() - 1; i++) {
-            std::string& a = tokens[i];
-            std::string& b = tokens[i+1];
-
-            switch (state)
-            {
-                case ParserState::TOP_LEVEL:
-                    if(a == "use") {
-                        if(b.starts_with("iee")) { continue; } // ignore standard lib
-                        unit.references. emplace(parse_reference(b));
-                    } else if(a == "entity") {
-                        unit.definitions.emplace_back(b);
-                        state = ParserState::ENTITY_DECL;
-                    } else if(a == "package") {
-                        unit.definitions.emplace_back(b);
-                        state = ParserState::PACKAGE_DECL;
-                    } else if (a == "architecture") {
-                        state = ParserState::ARCH_DECL;
-                    }
-                    break;
-                case ParserState::PACKAGE_DECL:
-                    if(a == "end") {
-                        state = ParserState::TOP_LEVEL;
-                        i++;
-                    }
-                    break;
-                case ParserState::ENTITY_DECL:
-                    if(a == "end") {
-                        state = ParserState::TOP_LEVEL;
-                        i++;
-                    }
-                    break;
-                case ParserState::ARCH_DECL:
-                    if(a == "procedure") {
-                        state = ParserState::PROCEDURE_DECL;
-                    } else if(a == "begin") {
-                        state = ParserState::ARCH_STATE;
-                    } else if (a == "component") {
-                        unit.references.emplace(parse_reference(b));
-                    }
-                    break;
-                case ParserState::ARCH_STATE:
-                    if(a == "end") {
-                        state = ParserState::TOP_LEVEL;
-                    } else if(a == "entity") {
-                        unit.references.emplace(parse_reference(b));
-                    }
-                    break;
-                case ParserState::PROCEDURE_DECL:
-                    if (a == "begin") {
-                        state = ParserState::PROCEDURE_BODY;
+        while(true) {
+            std::string_view prev = stream.last();
+            std::string_view a = stream.next();
+            if(a.empty()) {
+                break;
+            }
+
+            const size_t units_before = unit.design_units.size();
+            bool context_item = false;
+
+            if(iequals(prev, "end")) {
+                // end entity, end package body, ...
+            } else if(iequals(a, "use")) {
+                start_clause(a);
+                parse_use_clause(stream, references());
+                context_item = true;
+            } else if(iequals(a, "library")) {
+                start_clause(a);
+                while(!stream.peek().empty() && stream.peek() != ";") {
+                    stream.next();
+                }
+                context_item = true;
+            } else if(iequals(a, "entity")) {
+                if(prev == ":" && !iequals(stream.peek(), "is")) {
+                    // Direct instantiation, e.g. u0: entity work.foo(rtl)
+                    references().emplace(to_lower(selected_name(stream).back()));
+                } else if(iequals(stream.peek(1), "is")) {
+                    std::string name = to_lower(stream.next());
+                    begin_unit(UnitKind::ENTITY, name, a);
+                    state = ParserState::ENTITY_DECL;
+                }
+            } else if(iequals(a, "package")) {
+                if(iequals(stream.peek(), "body")) {
+                    stream.next();
+                    std::string name = to_lower(stream.next());
+                    begin_unit(UnitKind::PACKAGE_BODY, name, a);
+                    references().emplace(name);
+                    state = ParserState::PACKAGE_BODY;
+                } else if(iequals(stream.peek(1), "is")) {
+                    std::string name = to_lower(stream.next());
+                    begin_unit(UnitKind::PACKAGE, name, a);
+                    state = ParserState::PACKAGE_DECL;
+
+                    // Package instantiation, e.g. package p is new work.generic_pkg
+                    if(iequals(stream.peek(1), "new")) {
+                        stream.next();
+                        stream.next();
+                        references().emplace(to_lower(selected_name(stream).back()));
                     }
-                    break;
-                case ParserState::PROCEDURE_BODY:
-                    if(a == "end") {
-                        state = ParserState::ARCH_DECL;
+                }
+            } else if(iequals(a, "architecture")) {
+                if(iequals(stream.peek(1), "of")) {
+                    std::string entity = to_lower(stream.peek(2));
+                    begin_unit(UnitKind::ARCHITECTURE, entity + "(" + to_lower(stream.peek()) + ")", a);
+                    references().emplace(entity);
+                }
+                state = ParserState::ARCH_DECL;
+            } else if(iequals(a, "configuration")) {
+                if(prev == ":") {
+                    references().emplace(to_lower(selected_name(stream).back()));
+                } else if(iequals(stream.peek(1), "of")) {
+                    begin_unit(UnitKind::CONFIGURATION, to_lower(stream.peek()), a);
+                    references().emplace(to_lower(stream.peek(2)));
+                    state = ParserState::CONFIG_DECL;
+                }
+            } else if(iequals(a, "port")) {
+                // Testbenches are told apart by their missing ports
+                if(state == ParserState::ENTITY_DECL && !unit.design_units.empty()
+                        && unit.design_units.back().kind == UnitKind::ENTITY) {
+                    unit.design_units.back().ports = true;
+                }
+            } else if(iequals(a, "component")) {
+                if(prev == ":") {
+                    references().emplace(to_lower(selected_name(stream).back()));
+                } else if(state == ParserState::ARCH_DECL) {
+                    // Component declarations in packages don't depend on the entity
+                    references().emplace(to_lower(stream.peek()));
+                }
+            } else if(iequals(a, "context")) {
+                if(iequals(stream.peek(1), "is")) {
+                    begin_unit(UnitKind::CONTEXT, to_lower(stream.peek()), a);
+                } else {
+                    // Context reference, e.g. context work.ctx;
+                    start_clause(a);
+                    auto parts = selected_name(stream);
+                    if(parts.size() >= 2 && !is_standard_library(parts[0])) {
+                        references().emplace(to_lower(parts.back()));
                     }
-                    break;
+                    context_item = true;
+                }
+            }
+
+            // Any other token shows that the clauses were part of the current unit
+            if(in_clause && !context_item && a != ";" && unit.design_units.size() == units_before
+                    && !unit.design_units.empty()) {
+                unit.design_units.back().references.merge(pending);
+                pending.clear();
+                in_clause = false;
+            }
+        }
+
+        if(!unit.design_units.empty()) {
+            unit.design_units.back().references.merge(pending);
+        }
+
+        // Every unit reaches up to the next one, tokens before the first belong to the first.
+        // Comments, whitespace and case don't change the hash.
+        for(size_t i = 0; i < unit.design_units.size(); i++) {
+            size_t begin = i == 0 ? 0 : begins[i];
+            size_t end = i + 1 < begins.size() ? begins[i + 1] : source.size();
+            unit.design_units[i].hash = lexer.normalized_hash(begin, end);
+            unit.design_units[i].references.erase("");
+        }
+
+        unit.summarize();
+    }
+
+    const char* kind_name(UnitKind kind) {
+        switch(kind) {
+            case UnitKind::ENTITY: return "entity";
+            case UnitKind::ARCHITECTURE: return "architecture";
+            case UnitKind::PACKAGE: return "package";
+            case UnitKind::PACKAGE_BODY: return "package body";
+            case UnitKind::CONFIGURATION: return "configuration";
+            case UnitKind::CONTEXT: return "context";
+        }
+        return "unit";
+    }
+
+    std::string_view DesignUnit::primary() const {
+        if(kind == UnitKind::ARCHITECTURE) {
+            return std::string_view(name).substr(0, name.find('('));
+        }
+        return name;
+    }
+
+    void Unit::summarize() {
+        definitions.clear();
+        references.clear();
+
+        for(const auto& design_unit : design_units) {
+            if(is_primary(design_unit.kind)) {
+                definitions.push_back(design_unit.name);
             }
+            references.insert(design_unit.references.begin(), design_unit.references.end());
+        }
 
+        // Architectures and package bodies usually live next to their declaration
+        for(const auto& definition : definitions) {
+            references.erase(definition);
         }
+        references.erase("");
+    }
+
+    FileStat FileStat::from_file(const std::string& path) {
+        struct stat st;
+        if(::stat(path.c_str(), &st) != 0) {
+            return FileStat {};
+        }
+
+        return FileStat {
+            .mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec,
+            .size = static_cast<uint64_t>(st.st_size),
+            .inode = static_cast<uint64_t>(st.st_ino)
+        };
+    }
+
+    Unit Unit::from_file(const std::string& path) {
+        MappedFile file(path);
+        Trace::count(Trace::FILES_REHASHED);
+        Trace::count(Trace::BYTES_READ, file.view().size());
+
+        Lexer lexer(file.view());
+        TokenStream stream(lexer);
+
+        Unit unit { .path = path };
+        parse(file.view(), lexer, stream, unit);
+        unit.hash = lexer.hash();
 
         return unit;
     }
@@ -145,6 +314,11 @@ namespace vm {
             stream << "    " << x << std::endl;
         }
 
+        stream << "Design Units (" << unit.design_units.size() << ")" << std::endl;
+        for(const auto& x : unit.design_units) {
+            stream << "    " << kind_name(x.kind) << " " << x.name << std::endl;
+        }
+
         return stream;
     }
 
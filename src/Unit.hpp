@@ -3,19 +3,94 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <unordered_set>
+#include <cstdint>
 
 namespace vm {
+    // File metadata used to detect changes without reading the file
+    struct FileStat {
+        int64_t mtime = 0;
+        uint64_t size = 0;
+        uint64_t inode = 0;
+
+        static FileStat from_file(const std::string& path);
+
+        bool operator==(const FileStat& other) const = default;
+    };
+
+    enum class UnitKind : uint8_t {
+        ENTITY = 0,
+        ARCHITECTURE,
+        PACKAGE,
+        PACKAGE_BODY,
+        CONFIGURATION,
+        CONTEXT
+    };
+
+    // Primary units can be referenced by other units, secondary units can't
+    inline bool is_primary(UnitKind kind) {
+        return kind != UnitKind::ARCHITECTURE && kind != UnitKind::PACKAGE_BODY;
+    }
+
+    // The VHDL keywords of the kind, like "package body"
+    const char* kind_name(UnitKind kind);
+
+    // A library unit of a file together with its context clause
+    struct DesignUnit {
+        UnitKind kind;
+
+        // Architectures are named entity(architecture), package bodies after their package
+        std::string name;
+
+        // Over the normalized tokens of the unit, from its context clause up to the next unit
+        uint64_t hash = 0;
+
+        std::unordered_set<std::string> references;
+
+        // Entities only: the declaration has a port clause
+        bool ports = false;
+
+        // Name of the primary unit this unit belongs to
+        std::string_view primary() const;
+
+        bool operator==(const DesignUnit& other) const = default;
+    };
+
     struct Unit {
+        // Summary of the design units: names of the primary units and
+        // everything referenced that isn't defined in this file
         std::unordered_set<std::string> references;
         std::vector<std::string> definitions;
+
+        std::vector<DesignUnit> design_units;
+
         std::string path;
-        size_t hash;
+
+        // Over the exact bytes of the file
+        uint64_t hash;
+        FileStat stat;
+
+        // Analysis time of the last build in microseconds, 0 if unknown
+        uint32_t duration = 0;
+
+        // Changed, but left for later because the last build didn't need it
+        bool pending = false;
 
         static Unit from_file(const std::string& path);
 
+        // Fills definitions and references from the design units
+        void summarize();
+
         friend std::ostream& operator<< (std::ostream& stream, const Unit& unit);
     };
+
+    // Result of the last successful elaboration of an entity
+    struct Elaboration {
+        std::string entity;
+        uint64_t fingerprint = 0;   // of the sources it was elaborated from
+        FileStat binary;            // all zero if the backend doesn't write one
+    };
 } // namespace vm
 
 #endif
@@ -1,13 +1,20 @@
+#ifndef UTILITY_HPP
+#define UTILITY_HPP
+
 #include <string>
+#include <string_view>
 #include <vector>
 #include <iostream>
+#include <thread>
+#include <atomic>
+#include <algorithm>
 
 namespace vm
 {
     typedef unsigned char uchar;
-    static const std::string b = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    inline const std::string b = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
     
-    static std::string base64_encode(const std::string &in) {
+    inline std::string base64_encode(const std::string &in) {
         std::string out;
 
         int val=0, valb=-6;
@@ -25,7 +32,65 @@ namespace vm
         return out;
     }
 
-    static std::vector<std::string> command_get_lines(const std::string& command) {
+    // Calls fn(i) for every i in [0, count) on up to `workers` threads
+    template<typename F>
+    inline void parallel_for(size_t count, size_t workers, F fn) {
+        workers = std::clamp<size_t>(workers, 1, std::max<size_t>(count, 1));
+        if(workers == 1) {
+            for(size_t i = 0; i < count; i++) {
+                fn(i);
+            }
+            return;
+        }
+
+        std::atomic<size_t> next = 0;
+        std::vector<std::thread> threads;
+        for(size_t t = 0; t < workers; t++) {
+            threads.emplace_back([&] {
+                for(size_t i = next++; i < count; i = next++) {
+                    fn(i);
+                }
+            });
+        }
+
+        for(auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    // Quotes an argument for /bin/sh
+    inline std::string shell_quote(const std::string& arg) {
+        std::string quoted = "'";
+        for(char c : arg) {
+            if(c == '\'') {
+                quoted += "'\\''";
+            } else {
+                quoted += c;
+            }
+        }
+        return quoted + "'";
+    }
+
+    // Quotes a string for JSON. DOT understands the same escapes for quotes and backslashes.
+    inline std::string json_quote(std::string_view text) {
+        std::string quoted = "\"";
+        for(char c : text) {
+            if(c == '"' || c == '\\') {
+                quoted += '\\';
+                quoted += c;
+            } else if(static_cast<unsigned char>(c) < 0x20) {
+                static const char digits[] = "0123456789abcdef";
+                quoted += "\\u00";
+                quoted += digits[(c >> 4) & 0xF];
+                quoted += digits[c & 0xF];
+            } else {
+                quoted += c;
+            }
+        }
+        return quoted + "\"";
+    }
+
+    inline std::vector<std::string> command_get_lines(const std::string& command) {
         FILE* pipe = popen(command.c_str(), "r");
         if (!pipe) {
             throw std::runtime_error("popen() failed!");
@@ -43,8 +108,10 @@ namespace vm
             
         }
 
-        fclose(pipe);
+        pclose(pipe);
         free(line);
         return lines;
     }
 } // namespace vm
+
+#endif
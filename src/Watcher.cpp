@@ -0,0 +1,117 @@
+#include "Watcher.hpp"
+#include "Constants.hpp"
+#include "Scanner.hpp"
+
+#include <filesystem>
+#include <iostream>
+#include <algorithm>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+namespace fs = std::filesystem;
+
+namespace vm {
+    static constexpr uint32_t C_WATCH_MASK = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM
+                                           | IN_CREATE | IN_DELETE | IN_DELETE_SELF;
+
+    static std::string join(const std::string& directory, const std::string& name) {
+        return directory.empty() ? name : directory + "/" + name;
+    }
+
+    Watcher::Watcher(const std::string& directory) {
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if(fd < 0) {
+            std::cerr << "[ERROR] Could not initialize inotify" << std::endl;
+            return;
+        }
+
+        // Same rules as the scanner, so both see the same set of files
+        ignore.load(directory + "/" + std::string(C_IGNORE_FILE));
+
+        std::vector<std::string> found;
+        add_directory(directory == "." ? "" : directory, found);
+    }
+
+    Watcher::~Watcher() {
+        if(fd >= 0) {
+            close(fd);
+        }
+    }
+
+    void Watcher::add_directory(const std::string& path, std::vector<std::string>& found) {
+        int wd = inotify_add_watch(fd, path.empty() ? "." : path.c_str(), C_WATCH_MASK);
+        if(wd < 0) {
+            std::cerr << "[WARN] Could not watch " << path << std::endl;
+            return;
+        }
+        directories[wd] = path;
+
+        std::error_code error;
+        for(const auto& entry : fs::directory_iterator(path.empty() ? "." : path, error)) {
+            std::string name = entry.path().filename().string();
+            if(entry.is_directory(error) && !entry.is_symlink(error)) {
+                if(!ignore.matches(join(path, name), true)) {
+                    add_directory(join(path, name), found);
+                }
+            } else if(is_source_file(name) && !ignore.matches(join(path, name), false)) {
+                found.push_back(join(path, name));
+            }
+        }
+    }
+
+    void Watcher::read_events(std::vector<std::string>& changed) {
+        alignas(inotify_event) char buffer[16 * 1024];
+
+        while(true) {
+            ssize_t length = read(fd, buffer, sizeof(buffer));
+            if(length <= 0) {
+                return;
+            }
+
+            for(char* ptr = buffer; ptr < buffer + length; ) {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(ptr);
+                ptr += sizeof(inotify_event) + event->len;
+
+                if(event->mask & (IN_DELETE_SELF | IN_IGNORED)) {
+                    directories.erase(event->wd);
+                    continue;
+                }
+
+                auto it = directories.find(event->wd);
+                if(it == directories.end() || event->len == 0) {
+                    continue;
+                }
+
+                std::string name = event->name;
+                std::string path = join(it->second, name);
+
+                if(event->mask & IN_ISDIR) {
+                    // Files in new directories don't generate events of their own
+                    if((event->mask & (IN_CREATE | IN_MOVED_TO)) && !ignore.matches(path, true)) {
+                        add_directory(path, changed);
+                    }
+                } else if(is_source_file(name) && !(event->mask & IN_CREATE) && !ignore.matches(path, false)) {
+                    // Creating a file is followed by IN_CLOSE_WRITE once it is written
+                    changed.push_back(path);
+                }
+            }
+        }
+    }
+
+    std::vector<std::string> Watcher::wait(std::chrono::milliseconds debounce) {
+        std::vector<std::string> changed;
+        pollfd pfd { .fd = fd, .events = POLLIN, .revents = 0 };
+
+        // Wait for the first event, then until the tree is quiet again
+        int timeout = -1;
+        while(poll(&pfd, 1, timeout) > 0) {
+            read_events(changed);
+            timeout = changed.empty() ? -1 : static_cast<int>(debounce.count());
+        }
+
+        std::sort(changed.begin(), changed.end());
+        changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+        return changed;
+    }
+} // namespace vm
@@ -0,0 +1,37 @@
+#ifndef WATCHER_HPP
+#define WATCHER_HPP
+
+#include "Scanner.hpp"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+
+namespace vm {
+    // Watches a source tree with inotify and reports changed vhdl files
+    class Watcher {
+    public:
+        explicit Watcher(const std::string& directory);
+        ~Watcher();
+
+        Watcher(const Watcher&) = delete;
+        Watcher& operator=(const Watcher&) = delete;
+
+        bool is_open() const { return fd >= 0; }
+
+        // Blocks until files changed and then waits until no further event
+        // arrived for `debounce`, so a burst of saves is reported only once
+        std::vector<std::string> wait(std::chrono::milliseconds debounce);
+
+    private:
+        void add_directory(const std::string& path, std::vector<std::string>& found);
+        void read_events(std::vector<std::string>& changed);
+
+        int fd = -1;
+        IgnoreRules ignore;
+        std::unordered_map<int, std::string> directories;
+    };
+} // namespace vm
+
+#endif
@@ -0,0 +1,280 @@
+#include "WorkLibrary.hpp"
+#include "Constants.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+namespace fs = std::filesystem;
+
+namespace vm {
+    // Every design file in the index starts with a line like
+    //   file . "adder.vhdl" "20240101120000.000" "<sha1>" "<version>":
+    // followed by indented lines for its units. The key is everything up to the
+    // file name, the remaining fields change with every analysis.
+    static std::string block_key(const std::string& line) {
+        size_t pos = 5;
+        if(pos < line.size() && line[pos] == '"') {
+            pos = line.find('"', pos + 1);
+            if(pos == std::string::npos) { return line; }
+            pos++;
+        }
+
+        size_t open = line.find('"', pos);
+        if(open == std::string::npos) { return line; }
+        size_t close = line.find('"', open + 1);
+        if(close == std::string::npos) { return line; }
+
+        return line.substr(0, close + 1);
+    }
+
+    // The design file a block key names, relative to the working directory if
+    // the library lives there
+    static std::string block_file(const std::string& key) {
+        size_t pos = 5;
+        std::string directory;
+        if(pos < key.size() && key[pos] == '"') {
+            size_t close = key.find('"', pos + 1);
+            directory = key.substr(pos + 1, close - pos - 1);
+            pos = close + 1;
+        }
+
+        size_t open = key.find('"', pos);
+        if(open == std::string::npos || key.back() != '"') {
+            return "";
+        }
+        return directory + key.substr(open + 1, key.size() - open - 2);
+    }
+
+    // Unit lines end with the analysis date, like
+    //   entity adder at 1( 0) + 0 on 4;
+    //   package pkg at 5( 80) + 0 on 5 body;
+    // Returns the position of its digits, or false for other lines
+    static bool find_date(const std::string& line, size_t& begin, size_t& end) {
+        size_t on = line.rfind(" on ");
+        if(on == std::string::npos || !line.starts_with("  ")) {
+            return false;
+        }
+
+        begin = on + 4;
+        end = begin;
+        while(end < line.size() && line[end] >= '0' && line[end] <= '9') {
+            end++;
+        }
+        return end > begin;
+    }
+
+    static uint64_t latest_date(const std::string& block) {
+        uint64_t latest = 0;
+        std::istringstream stream(block);
+        std::string line;
+        size_t begin, end;
+        while(std::getline(stream, line)) {
+            if(find_date(line, begin, end)) {
+                latest = std::max<uint64_t>(latest, std::stoull(line.substr(begin, end - begin)));
+            }
+        }
+        return latest;
+    }
+
+    // Gives the units of a block the dates after `date`, in the order they were analysed
+    static std::string redate(const std::string& block, uint64_t& date) {
+        std::string result;
+        std::istringstream stream(block);
+        std::string line;
+        size_t begin, end;
+        while(std::getline(stream, line)) {
+            if(find_date(line, begin, end)) {
+                line.replace(begin, end - begin, std::to_string(++date));
+            }
+            result += line + "\n";
+        }
+        return result;
+    }
+
+    WorkLibrary::WorkLibrary(const std::string& directory, const std::string& index) : directory(directory), index(index) { }
+
+    WorkLibrary::~WorkLibrary() {
+        std::error_code error;
+        fs::remove_all(C_JOB_DIRECTORY, error);
+    }
+
+    WorkLibrary::Index WorkLibrary::parse_index(std::istream& stream) {
+        Index index;
+        std::string line;
+
+        while(std::getline(stream, line)) {
+            if(line.starts_with("file ")) {
+                index.blocks.emplace_back(block_key(line), line + "\n");
+            } else if(!index.blocks.empty()) {
+                index.blocks.back().second += line + "\n";
+            } else {
+                index.header += line + "\n";
+            }
+        }
+
+        return index;
+    }
+
+    WorkLibrary::Index WorkLibrary::read_index(const std::string& path) {
+        std::ifstream file(path);
+        return parse_index(file);
+    }
+
+    bool WorkLibrary::write_index(const std::string& path, const Index& index) {
+        // Write to a temporary file first, so readers never see half an index
+        std::string tmp_path = path + ".tmp";
+        {
+            std::ofstream file(tmp_path, std::ios::trunc);
+            if(!file.is_open()) {
+                return false;
+            }
+
+            file << index.header;
+            for(const auto& [key, block] : index.blocks) {
+                file << block;
+            }
+        }
+
+        std::error_code error;
+        fs::rename(tmp_path, path, error);
+        return !error;
+    }
+
+    std::string WorkLibrary::slot_directory(size_t slot) const {
+        return (fs::path(C_JOB_DIRECTORY) / ("job" + std::to_string(slot))).string();
+    }
+
+    std::string WorkLibrary::index_path() const {
+        return (fs::path(directory) / index).string();
+    }
+
+    std::string WorkLibrary::checkout(size_t slot) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        std::string slot_dir = slot_directory(slot);
+        fs::remove_all(slot_dir);
+        fs::create_directories(slot_dir);
+
+        if(fs::exists(index_path())) {
+            fs::copy_file(index_path(), fs::path(slot_dir) / index);
+        }
+
+        snapshots[slot] = read_index(index_path());
+        return slot_dir;
+    }
+
+    bool WorkLibrary::commit(size_t slot) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        std::string slot_dir = slot_directory(slot);
+        const Index& snapshot = snapshots[slot];
+        Index job = read_index((fs::path(slot_dir) / index).string());
+        Index shared = read_index(index_path());
+
+        if(shared.header.empty()) {
+            shared.header = job.header;
+        }
+
+        // Only take over blocks the job actually touched, other jobs may have
+        // committed newer versions of the rest in the meantime
+        for(const auto& block : job.blocks) {
+            if(std::find(snapshot.blocks.begin(), snapshot.blocks.end(), block) != snapshot.blocks.end()) {
+                continue;
+            }
+
+            auto it = std::find_if(shared.blocks.begin(), shared.blocks.end(), [&](const auto& b) {
+                return b.first == block.first;
+            });
+
+            if(it != shared.blocks.end()) {
+                it->second = block.second;
+            } else {
+                shared.blocks.push_back(block);
+            }
+        }
+
+        if(!write_index(index_path(), shared)) {
+            std::cerr << "[ERROR] Could not write " << index_path() << std::endl;
+            return false;
+        }
+
+        // Object files are only produced by the gcc and llvm backends
+        for(const auto& file : fs::directory_iterator(slot_dir)) {
+            if(file.path().extension() == ".o") {
+                fs::rename(file.path(), fs::path(directory) / file.path().filename());
+            }
+        }
+
+        snapshots.erase(slot);
+        return true;
+    }
+
+    std::unordered_map<std::string, std::string> WorkLibrary::extract(const std::string& directory, const std::vector<std::string>& files,
+                                                                  const std::string& index_name) {
+        std::unordered_map<std::string, std::string> result;
+        Index index = read_index((fs::path(directory) / index_name).string());
+
+        std::unordered_map<std::string, const std::string*> by_file;
+        for(const auto& [key, block] : index.blocks) {
+            by_file[block_file(key)] = &block;
+        }
+
+        // GHDL records files by the path they were analysed with, or with an absolute one
+        std::error_code error;
+        for(const auto& file : files) {
+            auto it = by_file.find(file);
+            if(it == by_file.end()) {
+                it = by_file.find(fs::absolute(file, error).string());
+            }
+            if(it != by_file.end()) {
+                result.emplace(file, index.header + *it->second);
+            }
+        }
+
+        return result;
+    }
+
+    bool WorkLibrary::merge(const std::string& directory, const std::vector<std::string>& indexes, const std::string& index_name) {
+        std::string path = (fs::path(directory) / index_name).string();
+        Index shared = read_index(path);
+
+        // A whole project may be restored at once, so blocks are looked up by key
+        std::unordered_map<std::string, size_t> positions;
+        uint64_t date = 0;
+        for(size_t i = 0; i < shared.blocks.size(); i++) {
+            positions.emplace(shared.blocks[i].first, i);
+            date = std::max(date, latest_date(shared.blocks[i].second));
+        }
+
+        // GHDL rejects a unit that is older than a unit it depends on. The stored
+        // dates come from other libraries, so the restored units get new ones after
+        // everything in this library, in the order of `indexes`.
+
+        for(const auto& text : indexes) {
+            std::istringstream stream(text);
+            Index index = parse_index(stream);
+            if(shared.header.empty()) {
+                shared.header = index.header;
+            }
+
+            for(auto& block : index.blocks) {
+                block.second = redate(block.second, date);
+                auto [it, inserted] = positions.emplace(block.first, shared.blocks.size());
+                if(inserted) {
+                    shared.blocks.push_back(std::move(block));
+                } else {
+                    shared.blocks[it->second].second = std::move(block.second);
+                }
+            }
+        }
+
+        if(!write_index(path, shared)) {
+            std::cerr << "[ERROR] Could not write " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+} // namespace vm
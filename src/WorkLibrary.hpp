@@ -0,0 +1,60 @@
+#ifndef WORK_LIBRARY_HPP
+#define WORK_LIBRARY_HPP
+
+#include "Constants.hpp"
+
+#include <string>
+#include <istream>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+
+namespace vm {
+    // GHDL rewrites the whole library index at the end of every analysis, so two
+    // `ghdl -a` calls working on the same directory lose each others units.
+    // Parallel jobs therefore analyse into a private directory which is seeded
+    // with a snapshot of the shared index and merged back once the job is done.
+    class WorkLibrary {
+    public:
+        // `index` is the name of the library index, it depends on the VHDL standard
+        explicit WorkLibrary(const std::string& directory, const std::string& index = std::string(C_WORK_LIBRARY));
+        ~WorkLibrary();
+
+        // Prepares the private directory of a job slot and returns its path
+        std::string checkout(size_t slot);
+
+        // Merges everything the job slot analysed back into the shared library
+        bool commit(size_t slot);
+
+        // Cuts the entries of the given design files out of the library index of
+        // `directory`. Each one is returned as an index of its own, keyed by path.
+        static std::unordered_map<std::string, std::string> extract(const std::string& directory, const std::vector<std::string>& files,
+                                                                    const std::string& index = std::string(C_WORK_LIBRARY));
+
+        // Adds indexes returned by extract to the library in `directory`, replacing
+        // the entries of the same files. The index is written once for all of them.
+        // Their units are dated after the library, so dependencies have to come first.
+        static bool merge(const std::string& directory, const std::vector<std::string>& indexes,
+                          const std::string& index = std::string(C_WORK_LIBRARY));
+
+    private:
+        struct Index {
+            std::string header;
+            std::vector<std::pair<std::string, std::string>> blocks;
+        };
+
+        static Index parse_index(std::istream& stream);
+        static Index read_index(const std::string& path);
+        static bool write_index(const std::string& path, const Index& index);
+
+        std::string slot_directory(size_t slot) const;
+        std::string index_path() const;
+
+        std::string directory;
+        std::string index;
+        std::unordered_map<size_t, Index> snapshots;
+        std::mutex mutex;
+    };
+} // namespace vm
+
+#endif
@@ -0,0 +1,73 @@
+#include "gtest/gtest.h"
+#include "project_test.hpp"
+#include "ArtifactStore.hpp"
+#include "WorkLibrary.hpp"
+
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+using ArtifactStoreTest = ProjectTest;
+
+TEST_F(ArtifactStoreTest, RestoresWhatWasStored) {
+    vm::ArtifactStore store((directory / "store").string());
+    write(directory / "adder.o", "object");
+
+    std::string block;
+    EXPECT_FALSE(store.restore(42, block, (directory / "restored.o").string()));
+
+    ASSERT_TRUE(store.store(42, "v 4\nfile . \"adder.vhdl\":\n", (directory / "adder.o").string()));
+    ASSERT_TRUE(store.restore(42, block, (directory / "restored.o").string()));
+    EXPECT_EQ(block, "v 4\nfile . \"adder.vhdl\":\n");
+    EXPECT_EQ(read(directory / "restored.o"), "object");
+
+    // Entries never change once they exist
+    EXPECT_TRUE(store.store(42, "v 4\nfile . \"other.vhdl\":\n", ""));
+    ASSERT_TRUE(store.restore(42, block, (directory / "restored.o").string()));
+    EXPECT_EQ(block, "v 4\nfile . \"adder.vhdl\":\n");
+}
+
+TEST_F(ArtifactStoreTest, MovesFilesBetweenLibraries) {
+    std::string work = (directory / "work").string();
+    write(directory / "work" / "work-obj08.cf",
+        "v 4\n"
+        "file . \"src/a.vhdl\" \"1\" \"h\" \"v\":\n  entity a at 1( 0) + 0 on 1;\n"
+        "file . \"src/b.vhdl\" \"2\" \"h\" \"v\":\n  entity b at 1( 0) + 0 on 2;\n");
+
+    auto indexes = vm::WorkLibrary::extract(work, { "src/b.vhdl", "src/missing.vhdl" });
+    ASSERT_EQ(indexes.size(), 1);
+    EXPECT_EQ(indexes["src/b.vhdl"], "v 4\nfile . \"src/b.vhdl\" \"2\" \"h\" \"v\":\n  entity b at 1( 0) + 0 on 2;\n");
+
+    // Replaces the entry of the same file and keeps the others
+    std::string other = (directory / "other").string();
+    fs::create_directories(other);
+    write(directory / "other" / "work-obj08.cf",
+        "v 4\n"
+        "file . \"src/b.vhdl\" \"9\" \"h\" \"v\":\n  entity old at 1( 0) + 0 on 9;\n"
+        "file . \"src/c.vhdl\" \"3\" \"h\" \"v\":\n  entity c at 1( 0) + 0 on 3;\n");
+
+    ASSERT_TRUE(vm::WorkLibrary::merge(other, { indexes["src/b.vhdl"] }));
+    EXPECT_EQ(read(directory / "other" / "work-obj08.cf"),
+        "v 4\n"
+        "file . \"src/b.vhdl\" \"2\" \"h\" \"v\":\n  entity b at 1( 0) + 0 on 10;\n"
+        "file . \"src/c.vhdl\" \"3\" \"h\" \"v\":\n  entity c at 1( 0) + 0 on 3;\n");
+}
+
+TEST_F(ArtifactStoreTest, RestoredUnitsAreNewerThanTheLibrary) {
+    write("work-obj08.cf",
+        "v 4\n"
+        "file . \"src/pkg.vhdl\" \"1\" \"h\" \"v\":\n  package pkg at 1( 0) + 0 on 40;\n");
+
+    // Stored by another project whose library had older dates
+    std::string restored_pkg = "v 4\nfile . \"src/util.vhdl\" \"1\" \"h\" \"v\":\n"
+        "  package util at 1( 0) + 0 on 3 body;\n  package body util at 9( 120) + 0 on 4;\n";
+    std::string restored_tb = "v 4\nfile . \"src/tb.vhdl\" \"1\" \"h\" \"v\":\n  entity tb at 1( 0) + 0 on 2;\n";
+
+    ASSERT_TRUE(vm::WorkLibrary::merge(".", { restored_pkg, restored_tb }));
+    EXPECT_EQ(read("work-obj08.cf"),
+        "v 4\n"
+        "file . \"src/pkg.vhdl\" \"1\" \"h\" \"v\":\n  package pkg at 1( 0) + 0 on 40;\n"
+        "file . \"src/util.vhdl\" \"1\" \"h\" \"v\":\n"
+        "  package util at 1( 0) + 0 on 41 body;\n  package body util at 9( 120) + 0 on 42;\n"
+        "file . \"src/tb.vhdl\" \"1\" \"h\" \"v\":\n  entity tb at 1( 0) + 0 on 43;\n");
+}
@@ -0,0 +1,94 @@
+#include "gtest/gtest.h"
+#include "project_test.hpp"
+#include "Backend.hpp"
+
+using Args = std::vector<std::string>;
+
+TEST(Backend, GhdlIsTheDefault) {
+    vm::Backend ghdl;
+    EXPECT_EQ(ghdl.cmd_analyse({ "a.vhdl", "b.vhdl" }), (Args { "ghdl", "-a", "--std=08", "a.vhdl", "b.vhdl" }));
+    EXPECT_EQ(ghdl.cmd_analyse({ "a.vhdl" }, "job0"), (Args { "ghdl", "-a", "--std=08", "--workdir=job0", "a.vhdl" }));
+    EXPECT_EQ(ghdl.cmd_elaborate("tb"), (Args { "ghdl", "-e", "--std=08", "tb" }));
+    EXPECT_EQ(ghdl.cmd_run("tb", "ghw/tb.ghw"), (Args { "ghdl", "-r", "--std=08", "tb", "--wave=ghw/tb.ghw" }));
+    EXPECT_EQ(ghdl.library_index(), "work-obj08.cf");
+    EXPECT_EQ(ghdl.library_directory(), ".");
+
+    // GHDL keeps VHDL-2002 designs in the VHDL-93 library
+    ghdl.standard = "02";
+    EXPECT_EQ(ghdl.library_index(), "work-obj93.cf");
+}
+
+TEST(Backend, NvcPutsGlobalOptionsFirst) {
+    vm::Backend nvc;
+    ASSERT_TRUE(vm::Backend::preset("nvc", nvc));
+    nvc.standard = "19";
+    nvc.workdir = "build";
+    nvc.flags = { "--relaxed" };
+    nvc.run_flags = { "--stop-time=1us" };
+
+    EXPECT_EQ(nvc.cmd_analyse({ "a.vhdl" }), (Args { "nvc", "--std=19", "--work=build", "-a", "--relaxed", "a.vhdl" }));
+    EXPECT_EQ(nvc.cmd_elaborate("tb"), (Args { "nvc", "--std=19", "--work=build", "-e", "tb" }));
+    EXPECT_EQ(nvc.cmd_run("tb", "ghw/tb.fst"), (Args { "nvc", "--std=19", "--work=build", "-r", "--wave=ghw/tb.fst", "--stop-time=1us", "tb" }));
+    EXPECT_EQ(nvc.library_index(), "");
+    EXPECT_FALSE(nvc.parallel);
+    EXPECT_FALSE(vm::Backend::preset("modelsim", nvc));
+}
+
+TEST(Backend, HashesFollowTheFlags) {
+    vm::Backend a;
+    vm::Backend b;
+    EXPECT_EQ(a.analysis_hash(), b.analysis_hash());
+
+    b.elaborate_flags = { "-Wl,-static" };
+    EXPECT_EQ(a.analysis_hash(), b.analysis_hash());
+    EXPECT_NE(a.elaboration_hash(), b.elaboration_hash());
+
+    // Scheduling doesn't change what gets analysed
+    b.batch = false;
+    b.parallel = false;
+    b.run_flags = { "--stop-time=1us" };
+    EXPECT_EQ(a.analysis_hash(), b.analysis_hash());
+
+    b.standard = "93";
+    EXPECT_NE(a.analysis_hash(), b.analysis_hash());
+}
+
+using BackendTest = ProjectTest;
+
+TEST_F(BackendTest, LoadsProjectConfig) {
+    vm::Backend backend;
+    ASSERT_TRUE(vm::Backend::load("vhdlmake.json", backend));
+    EXPECT_EQ(backend.executable, "ghdl");
+
+    write("vhdlmake.json", R"({ "tool": "nvc", "std": "19", "flags": ["--relaxed"], "workdir": "build" })");
+    ASSERT_TRUE(vm::Backend::load("vhdlmake.json", backend));
+    EXPECT_EQ(backend.tool, vm::Backend::Tool::NVC);
+    EXPECT_EQ(backend.executable, "nvc");
+    EXPECT_EQ(backend.standard, "19");
+    EXPECT_EQ(backend.flags, (Args { "--relaxed" }));
+    EXPECT_EQ(backend.workdir, "build");
+
+    write("vhdlmake.json", R"({ "tool": "ghdl", "flags": "-frelaxed" })");
+    EXPECT_FALSE(vm::Backend::load("vhdlmake.json", backend));
+
+    write("vhdlmake.json", R"({ "std": "2008" })");
+    EXPECT_FALSE(vm::Backend::load("vhdlmake.json", backend));
+
+    write("vhdlmake.json", R"({ "std": "87" })");
+    EXPECT_TRUE(vm::Backend::load("vhdlmake.json", backend));
+    write("vhdlmake.json", R"({ "tool": "nvc", "std": "87" })");
+    EXPECT_FALSE(vm::Backend::load("vhdlmake.json", backend));
+}
+
+TEST_F(BackendTest, WorkdirStaysAwayFromTheProject) {
+    // clean deletes NVC's library, so it can't be the project or hold sources
+    vm::Backend backend;
+    write("src/rtl/adder.vhdl");
+    for(const char* workdir : { ".", "./", "/tmp/work", "../work", "build/../..", "src" }) {
+        write("vhdlmake.json", std::string(R"({ "tool": "nvc", "workdir": ")") + workdir + R"(" })");
+        EXPECT_FALSE(vm::Backend::load("vhdlmake.json", backend)) << workdir;
+    }
+
+    write("vhdlmake.json", R"({ "tool": "nvc", "workdir": "src/lib" })");
+    EXPECT_TRUE(vm::Backend::load("vhdlmake.json", backend));
+}
@@ -0,0 +1,206 @@
+#include "gtest/gtest.h"
+#include "project_test.hpp"
+#include "Builder.hpp"
+#include "DependencyGraph.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Stands in for `ghdl -a`: logs when every call begins and ends, and adds a block
+// for each of its files to the index in --workdir, replacing an older one. Like
+// GHDL it stops at the first file that doesn't analyse, here one containing FAIL.
+static const char* C_FAKE_GHDL = R"sh(#!/bin/sh
+log=$(dirname "$0")/analysis.log
+mode=$1
+shift
+workdir=.
+files=
+for arg in "$@"; do
+    case $arg in
+        --workdir=*) workdir=${arg#--workdir=} ;;
+        -*) ;;
+        *) files="$files $arg" ;;
+    esac
+done
+[ "$mode" = "-a" ] || exit 0
+
+echo "begin$files" >> "$log"
+sleep 0.1
+for file in $files; do
+    if grep -q FAIL "$file"; then
+        echo "$file:1:1: error: does not analyse" >&2
+        echo "end$files" >> "$log"
+        exit 1
+    fi
+
+    index=$workdir/work-obj08.cf
+    [ -f "$index" ] || echo "v 4" > "$index"
+    awk -v key="file . \"$file\"" '/^file / { skip = index($0, key) == 1 } !skip' "$index" > "$index.tmp"
+    printf 'file . "%s" "20240101000000.000" "0" "v":\n  entity %s at 1( 0) + 0 on 1;\n' "$file" "$(basename "$file" .vhdl)" >> "$index.tmp"
+    mv "$index.tmp" "$index"
+done
+echo "end$files" >> "$log"
+)sh";
+
+class BuilderTest : public ProjectTest {
+protected:
+    void SetUp() override {
+        ProjectTest::SetUp();
+        write("fake_ghdl", C_FAKE_GHDL);
+        fs::permissions("fake_ghdl", fs::perms::owner_all);
+
+        options.store = false;
+        options.backend.executable = (directory / "fake_ghdl").string();
+    }
+
+    void write_entity(const std::string& path, const std::string& name, const std::string& uses = "") {
+        write(path, uses + "\nentity " + name + " is\nend entity;\narchitecture rtl of " + name + " is\nbegin\nend architecture;\n");
+    }
+
+    // Scans the project and analyses everything that changed
+    int build(vm::BuildPlan& plan) {
+        plan = vm::DependencyGraph(options).get_build_plan();
+        return vm::Builder(options).build("", plan);
+    }
+
+    // Calls of the fake tool in the order they began and ended, like "begin src/a.vhdl"
+    std::vector<std::string> calls() {
+        std::vector<std::string> lines;
+        std::istringstream stream(read("analysis.log"));
+        for(std::string line; std::getline(stream, line);) {
+            lines.push_back(line);
+        }
+        return lines;
+    }
+
+    // Design files in the library index, in the order of their blocks
+    std::vector<std::string> library() {
+        std::vector<std::string> files;
+        std::istringstream stream(read("work-obj08.cf"));
+        for(std::string line; std::getline(stream, line);) {
+            if(line.starts_with("file . \"")) {
+                files.push_back(line.substr(8, line.find('"', 8) - 8));
+            }
+        }
+        return files;
+    }
+
+    static size_t position(const std::vector<std::string>& list, const std::string& line) {
+        return std::find(list.begin(), list.end(), line) - list.begin();
+    }
+
+    static std::vector<std::string> sorted(std::vector<std::string> list) {
+        std::sort(list.begin(), list.end());
+        return list;
+    }
+
+    vm::Options options;
+};
+
+TEST_F(BuilderTest, ParallelJobsMergeTheirLibraries) {
+    write("src/pkg.vhdl", "package pkg is\nend package;\n");
+    for(const std::string name : {"a", "b", "c", "d"}) {
+        write_entity("src/" + name + ".vhdl", name, "use work.pkg.all;");
+    }
+    write_entity("src/top.vhdl", "top", "use work.a; use work.b; use work.c; use work.d;");
+    options.jobs = 2;
+
+    vm::BuildPlan plan;
+    ASSERT_EQ(build(plan), 0);
+    EXPECT_TRUE(std::all_of(plan.begin(), plan.end(), [](const vm::BuildStep& step) { return step.done; }));
+
+    // One call per file, never more than two at a time, and both slots in use
+    std::vector<std::string> log = calls();
+    ASSERT_EQ(log.size(), 12);
+    int running = 0;
+    int most = 0;
+    for(const auto& line : log) {
+        running += line.starts_with("begin") ? 1 : -1;
+        most = std::max(most, running);
+    }
+    EXPECT_EQ(most, 2);
+
+    // Every file only begins after the files it uses ended
+    for(const std::string name : {"a", "b", "c", "d"}) {
+        EXPECT_LT(position(log, "end src/pkg.vhdl"), position(log, "begin src/" + name + ".vhdl"));
+        EXPECT_LT(position(log, "end src/" + name + ".vhdl"), position(log, "begin src/top.vhdl"));
+    }
+
+    // Each job analysed into its own copy, all blocks end up in the shared index once
+    EXPECT_EQ(sorted(library()), (std::vector<std::string> { "src/a.vhdl", "src/b.vhdl", "src/c.vhdl", "src/d.vhdl", "src/pkg.vhdl", "src/top.vhdl" }));
+    EXPECT_TRUE(read("work-obj08.cf").starts_with("v 4\n"));
+    EXPECT_FALSE(fs::exists(".vhdlmake.d"));
+
+    // A second round replaces the blocks of the changed files instead of adding them
+    vm::DependencyGraph(options).save_cache();
+    write_entity("src/b.vhdl", "b", "library ieee; use work.pkg.all;");
+    write_entity("src/c.vhdl", "c", "library ieee; use work.pkg.all;");
+    fs::remove("analysis.log");
+    ASSERT_EQ(build(plan), 0);
+    EXPECT_EQ(plan.size(), 3);
+    EXPECT_EQ(calls().size(), 6);
+    EXPECT_EQ(sorted(library()), (std::vector<std::string> { "src/a.vhdl", "src/b.vhdl", "src/c.vhdl", "src/d.vhdl", "src/pkg.vhdl", "src/top.vhdl" }));
+}
+
+TEST_F(BuilderTest, FailureStopsNewJobs) {
+    write("src/pkg.vhdl", "-- FAIL\npackage pkg is\nend package;\n");
+    write_entity("src/alpha.vhdl", "alpha", "use work.pkg.all;");
+    write_entity("src/other.vhdl", "other");
+    options.jobs = 2;
+
+    testing::internal::CaptureStderr();
+    vm::BuildPlan plan;
+    EXPECT_NE(build(plan), 0);
+    std::string output = testing::internal::GetCapturedStderr();
+
+    // The job running next to the broken file finishes, its dependants never start
+    EXPECT_EQ(sorted(calls()), (std::vector<std::string> { "begin src/other.vhdl", "begin src/pkg.vhdl", "end src/other.vhdl", "end src/pkg.vhdl" }));
+    EXPECT_EQ(library(), std::vector<std::string> { "src/other.vhdl" });
+    EXPECT_NE(output.find("src/pkg.vhdl:1:1: error"), std::string::npos);
+    EXPECT_NE(output.find("[ERROR] src/pkg.vhdl failed"), std::string::npos);
+
+    for(const auto& step : plan) {
+        EXPECT_EQ(step.done, step.path == "src/other.vhdl") << step.path;
+    }
+}
+
+TEST_F(BuilderTest, BrokenFileInABatchIsFoundAlone) {
+    for(const std::string name : {"a", "b", "c", "d"}) {
+        write_entity("src/" + name + ".vhdl", name, name == "c" ? "-- FAIL" : "");
+    }
+    write_entity("src/top.vhdl", "top", "use work.a; use work.b; use work.c; use work.d;");
+
+    for(int jobs : {1, 2}) {
+        fs::remove("analysis.log");
+        fs::remove("work-obj08.cf");
+        fs::remove(".vhdlmake.journal");
+        options.jobs = jobs;
+        options.batch = 4;
+
+        testing::internal::CaptureStderr();
+        vm::BuildPlan plan;
+        EXPECT_NE(build(plan), 0);
+        std::string output = testing::internal::GetCapturedStderr();
+
+        // The first calls get 4 / jobs files each, then the broken batch is analysed file by file
+        std::vector<std::string> log = calls();
+        ASSERT_FALSE(log.empty());
+        EXPECT_EQ(std::count(log[0].begin(), log[0].end(), ' '), 4 / jobs) << log[0];
+        EXPECT_LT(position(log, "begin src/c.vhdl"), log.size()) << jobs;
+
+        // The other files of the failed batch are analysed anyway, only their dependant isn't
+        EXPECT_EQ(sorted(library()), (std::vector<std::string> { "src/a.vhdl", "src/b.vhdl", "src/d.vhdl" })) << jobs;
+        EXPECT_EQ(position(log, "begin src/top.vhdl"), log.size()) << jobs;
+
+        // Its message shows up once, from the call that only had the broken file
+        EXPECT_EQ(output.find("error"), output.rfind("error")) << output;
+        EXPECT_NE(output.find("src/c.vhdl:1:1: error"), std::string::npos) << output;
+        EXPECT_NE(output.find("[ERROR] src/c.vhdl failed"), std::string::npos) << output;
+        EXPECT_EQ(output.find("[ERROR]"), output.rfind("[ERROR]")) << output;
+    }
+}
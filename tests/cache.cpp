@@ -0,0 +1,69 @@
+#include "gtest/gtest.h"
+#include "Cache.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static std::string cache_path() {
+    return (fs::temp_directory_path() / ("vhdlmake_cache_" + std::to_string(getpid()))).string();
+}
+
+TEST(Cache, RoundTrip) {
+    vm::Unit a { .design_units = {
+                     { .kind = vm::UnitKind::ENTITY, .name = "adder", .hash = 5, .references = {"pkg"}, .ports = true },
+                     { .kind = vm::UnitKind::ARCHITECTURE, .name = "adder(rtl)", .hash = 6, .references = {"adder", "util"} } },
+                 .path = "src/adder.vhdl", .hash = 42, .stat = { .mtime = 1, .size = 2, .inode = 3 }, .duration = 1500, .pending = true };
+    vm::Unit b { .design_units = { { .kind = vm::UnitKind::PACKAGE, .name = "pkg" } }, .path = "src/pkg.vhdl", .hash = 7 };
+    a.summarize();
+    b.summarize();
+
+    vm::Elaboration tb { .entity = "tb_adder", .fingerprint = 99, .binary = { .mtime = 4, .size = 5, .inode = 6 } };
+
+    ASSERT_TRUE(vm::Cache::save(cache_path(), { &b, &a }, {}, { tb }));
+
+    {
+        vm::Cache cache(cache_path());
+        EXPECT_FALSE(cache.is_outdated());
+        EXPECT_EQ(cache.size(), 2);
+        EXPECT_EQ(cache.find("src/missing.vhdl"), nullptr);
+
+        const vm::Cache::Entry* entry = cache.find("src/adder.vhdl");
+        ASSERT_NE(entry, nullptr);
+
+        vm::Unit unit = cache.to_unit(*entry);
+        EXPECT_EQ(unit.path, a.path);
+        EXPECT_EQ(unit.hash, a.hash);
+        EXPECT_EQ(unit.stat, a.stat);
+        EXPECT_EQ(unit.duration, a.duration);
+        EXPECT_TRUE(unit.pending);
+        EXPECT_FALSE(cache.to_unit(*cache.find("src/pkg.vhdl")).pending);
+        EXPECT_EQ(unit.definitions, a.definitions);
+        EXPECT_EQ(unit.references, a.references);
+        EXPECT_EQ(unit.design_units, a.design_units);
+
+        auto elaborations = cache.get_elaborations();
+        ASSERT_EQ(elaborations.size(), 1);
+        EXPECT_EQ(elaborations[0].entity, tb.entity);
+        EXPECT_EQ(elaborations[0].fingerprint, tb.fingerprint);
+        EXPECT_EQ(elaborations[0].binary, tb.binary);
+    }
+
+    fs::remove(cache_path());
+}
+
+TEST(Cache, RejectsOtherFormats) {
+    {
+        std::ofstream file(cache_path());
+        file << "{\"src/adder.vhdl\": 42}";
+    }
+
+    vm::Cache cache(cache_path());
+    EXPECT_TRUE(cache.is_outdated());
+    EXPECT_EQ(cache.size(), 0);
+    EXPECT_EQ(cache.find("src/adder.vhdl"), nullptr);
+
+    fs::remove(cache_path());
+}
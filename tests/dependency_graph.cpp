@@ -1,8 +1,559 @@
 #include "gtest/gtest.h"
+#include "project_test.hpp"
 #include "DependencyGraph.hpp"
 
 #include <memory>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstdlib>
+#include <set>
+#include <chrono>
+
+namespace fs = std::filesystem;
 
 TEST(DependencyGraph, SimpleTest) {
 
 }
+
+class DependencyGraphTest : public ProjectTest {
+protected:
+    void write_entity(const std::string& path, const std::string& name, const std::string& uses = "") {
+        write(path, uses + "\nentity " + name + " is\nend entity;\narchitecture rtl of " + name + " is\nbegin\nend architecture;\n");
+    }
+
+    static size_t position(const std::vector<std::string>& list, const std::string& path) {
+        return std::find(list.begin(), list.end(), path) - list.begin();
+    }
+};
+
+TEST_F(DependencyGraphTest, UpdateListRespectsDependencies) {
+    write("src/pkg.vhdl", "package pkg is\nend package;\n");
+    write_entity("src/alpha.vhdl", "alpha", "use work.pkg.all;");
+    write_entity("src/beta.vhdl", "beta", "use work.pkg.all;");
+
+    vm::DependencyGraph graph;
+    auto list = graph.get_update_list();
+
+    ASSERT_EQ(list.size(), 3);
+    EXPECT_LT(position(list, "src/pkg.vhdl"), position(list, "src/alpha.vhdl"));
+    EXPECT_LT(position(list, "src/pkg.vhdl"), position(list, "src/beta.vhdl"));
+}
+
+TEST_F(DependencyGraphTest, ScanIsReproducible) {
+    write("pkg/base.vhdl", "package base is\nend package;\n");
+    for(const std::string name : {"one", "two", "three", "four", "five", "six"}) {
+        write_entity("src/" + name + ".vhdl", name, "use work.base.all;");
+    }
+
+    vm::DependencyGraph first;
+    vm::DependencyGraph second;
+
+    EXPECT_EQ(first.get_update_list(), second.get_update_list());
+}
+
+TEST_F(DependencyGraphTest, UnchangedFilesAreNotRebuilt) {
+    write("src/pkg.vhdl", "package pkg is\nend package;\n");
+    write_entity("src/alpha.vhdl", "alpha", "use work.pkg.all;");
+
+    vm::DependencyGraph(vm::Options {}).save_cache();
+
+    EXPECT_TRUE(vm::DependencyGraph().get_update_list().empty());
+    EXPECT_TRUE(vm::DependencyGraph(vm::Options { .paranoid = true }).get_update_list().empty());
+}
+
+TEST_F(DependencyGraphTest, RecentlyWrittenFilesAreRehashed) {
+    write("src/old.vhdl", "package old is\n constant c : integer := 1;\nend package;\n");
+    write("src/new.vhdl", "package new is\n constant c : integer := 1;\nend package;\n");
+    auto old_mtime = fs::last_write_time("src/old.vhdl") - std::chrono::seconds(10);
+    auto new_mtime = fs::last_write_time("src/new.vhdl");
+    fs::last_write_time("src/old.vhdl", old_mtime);
+    vm::DependencyGraph(vm::Options {}).save_cache();
+
+    // Same size, inode and mtime, as if both were written again within the mtime granularity
+    write("src/old.vhdl", "package old is\n constant c : integer := 2;\nend package;\n");
+    write("src/new.vhdl", "package new is\n constant c : integer := 2;\nend package;\n");
+    fs::last_write_time("src/old.vhdl", old_mtime);
+    fs::last_write_time("src/new.vhdl", new_mtime);
+
+    // Only the file written right before the scan is read again
+    EXPECT_EQ(vm::DependencyGraph().get_update_list(), std::vector<std::string> { "src/new.vhdl" });
+    EXPECT_EQ(vm::DependencyGraph(vm::Options { .paranoid = true }).get_update_list().size(), 2);
+}
+
+TEST_F(DependencyGraphTest, UpdateReparsesOnlyGivenFiles) {
+    write("src/pkg.vhdl", "package pkg is\nend package;\n");
+    write_entity("src/alpha.vhdl", "alpha", "use work.pkg.all;");
+    write_entity("src/beta.vhdl", "beta");
+
+    vm::DependencyGraph graph;
+    graph.commit();
+    EXPECT_TRUE(graph.get_update_list().empty());
+
+    // Changing the package invalidates its dependants
+    write("src/pkg.vhdl", "package pkg is\n constant c : integer := 1;\nend package;\n");
+    graph.update({"src/pkg.vhdl"});
+    auto list = graph.get_update_list();
+    ASSERT_EQ(list.size(), 2);
+    EXPECT_EQ(list[0], "src/pkg.vhdl");
+    EXPECT_EQ(list[1], "src/alpha.vhdl");
+    graph.commit();
+
+    // New files are added, deleted files invalidate their dependants
+    write_entity("src/gamma.vhdl", "gamma", "use work.pkg.all;");
+    fs::remove("src/pkg.vhdl");
+    graph.update({"src/gamma.vhdl", "src/pkg.vhdl"});
+    list = graph.get_update_list();
+    std::sort(list.begin(), list.end());
+    EXPECT_EQ(list, (std::vector<std::string> { "src/alpha.vhdl", "src/gamma.vhdl" }));
+}
+
+TEST_F(DependencyGraphTest, InvalidateMarksDependants) {
+    write("src/pkg.vhdl", "package pkg is\nend package;\n");
+    write_entity("src/alpha.vhdl", "alpha", "use work.pkg.all;");
+    write_entity("src/beta.vhdl", "beta");
+
+    std::vector<vm::Unit> units;
+    for(const std::string path : {"src/pkg.vhdl", "src/alpha.vhdl", "src/beta.vhdl"}) {
+        units.push_back(vm::Unit::from_file(path));
+    }
+
+    vm::DependencyGraph graph(units, std::vector<uint8_t>(units.size(), 0));
+    EXPECT_TRUE(graph.get_update_list().empty());
+
+    graph.invalidate({"src/pkg.vhdl"});
+    EXPECT_EQ(graph.get_update_list(), (std::vector<std::string> { "src/pkg.vhdl", "src/alpha.vhdl" }));
+}
+
+TEST_F(DependencyGraphTest, CriticalPathIsScheduledFirst) {
+    write("src/a_short.vhdl", "package a_short is\nend package;\n");
+    write("src/b_long.vhdl", "package b_long is\nend package;\n");
+    write_entity("src/c_user.vhdl", "c_user", "use work.b_long.all;");
+
+    std::vector<vm::Unit> units;
+    for(const std::string path : {"src/a_short.vhdl", "src/b_long.vhdl", "src/c_user.vhdl"}) {
+        units.push_back(vm::Unit::from_file(path));
+        units.back().duration = 1000;
+    }
+
+    // b_long gates another file, so it has to start before a_short although it sorts later
+    vm::DependencyGraph graph(units, std::vector<uint8_t>(units.size(), 1));
+    EXPECT_EQ(graph.get_update_list().front(), "src/b_long.vhdl");
+
+    // Measured times take precedence over the shape of the graph
+    vm::BuildPlan plan = graph.get_build_plan();
+    for(auto& step : plan) {
+        if(step.path == "src/a_short.vhdl") {
+            step.duration = 5000;
+        }
+    }
+    graph.record_durations(plan);
+    EXPECT_EQ(graph.get_update_list().front(), "src/a_short.vhdl");
+}
+
+TEST_F(DependencyGraphTest, FingerprintCoversTheClosure) {
+    write("src/pkg.vhdl", "package pkg is\nend package;\n");
+    write("src/alpha.vhdl", "use work.pkg.all;\nentity alpha is\nend entity;\n");
+    write("src/alpha_rtl.vhdl", "architecture rtl of alpha is\nbegin\nend architecture;\n");
+    write_entity("src/beta.vhdl", "beta");
+
+    vm::DependencyGraph graph;
+    uint64_t fingerprint = graph.get_fingerprint("Alpha");
+    EXPECT_NE(fingerprint, 0);
+    EXPECT_EQ(graph.get_fingerprint("missing"), 0);
+
+    // Files outside the closure don't matter
+    write_entity("src/beta.vhdl", "beta", "-- changed");
+    graph.update({"src/beta.vhdl"});
+    EXPECT_EQ(graph.get_fingerprint("alpha"), fingerprint);
+
+    // Dependencies and separate architectures do
+    write("src/alpha_rtl.vhdl", "architecture rtl of alpha is\n signal s : bit;\nbegin\nend architecture;\n");
+    graph.update({"src/alpha_rtl.vhdl"});
+    EXPECT_NE(graph.get_fingerprint("alpha"), fingerprint);
+    fingerprint = graph.get_fingerprint("alpha");
+
+    write("src/pkg.vhdl", "package pkg is\n constant c : integer := 1;\nend package;\n");
+    graph.update({"src/pkg.vhdl"});
+    EXPECT_NE(graph.get_fingerprint("alpha"), fingerprint);
+}
+
+TEST_F(DependencyGraphTest, ElaborationIsSkippedUntilSomethingChanged) {
+    write_entity("src/alpha.vhdl", "alpha");
+
+    {
+        vm::DependencyGraph graph;
+        EXPECT_FALSE(graph.is_elaborated("alpha"));
+        std::ofstream("alpha") << "binary";
+        graph.record_elaboration("alpha");
+        graph.save_cache();
+    }
+
+    EXPECT_TRUE(vm::DependencyGraph().is_elaborated("alpha"));
+
+    // A rewritten or deleted binary has to be elaborated again
+    fs::remove("alpha");
+    EXPECT_FALSE(vm::DependencyGraph().is_elaborated("alpha"));
+
+    // mcode GHDL doesn't write one at all
+    {
+        vm::DependencyGraph graph;
+        graph.record_elaboration("alpha");
+        graph.save_cache();
+    }
+    EXPECT_TRUE(vm::DependencyGraph().is_elaborated("alpha"));
+}
+
+TEST_F(DependencyGraphTest, BackendChangesInvalidateWhatTheyAffect) {
+    write_entity("src/alpha.vhdl", "alpha");
+    write_entity("src/beta.vhdl", "beta");
+
+    {
+        vm::DependencyGraph graph;
+        std::ofstream("alpha") << "binary";
+        graph.record_elaboration("alpha");
+        graph.commit();
+        graph.save_cache();
+    }
+
+    // Elaboration flags only make the binary outdated
+    vm::Options options;
+    options.backend.elaborate_flags = { "-Wl,-static" };
+    vm::DependencyGraph elaborate(options);
+    EXPECT_TRUE(elaborate.get_update_list().empty());
+    EXPECT_FALSE(elaborate.is_elaborated("alpha"));
+
+    // Analysis flags change the whole library
+    options.backend.flags = { "-frelaxed" };
+    EXPECT_EQ(vm::DependencyGraph(options).get_update_list().size(), 2);
+
+    ASSERT_TRUE(vm::Backend::preset("nvc", options.backend));
+    EXPECT_EQ(vm::DependencyGraph(options).get_update_list().size(), 2);
+    EXPECT_TRUE(vm::DependencyGraph().get_update_list().empty());
+}
+
+TEST_F(DependencyGraphTest, BodyChangesStayInTheirFile) {
+    write("src/pkg.vhdl", "package pkg is\nend package;\n");
+    write("src/pkg_body.vhdl", "package body pkg is\nend package body;\n");
+    write("src/alpha.vhdl", "use work.pkg.all;\nentity alpha is\nend entity;\n");
+    write("src/alpha_rtl.vhdl", "architecture rtl of alpha is\nbegin\nend architecture;\n");
+    write_entity("src/top.vhdl", "top", "use work.alpha;");
+    vm::DependencyGraph(vm::Options {}).save_cache();
+
+    write("src/pkg_body.vhdl", "package body pkg is\n constant c : integer := 1;\nend package body;\n");
+    write("src/alpha_rtl.vhdl", "architecture rtl of alpha is\n signal s : bit;\nbegin\nend architecture;\n");
+    auto list = vm::DependencyGraph().get_update_list();
+    std::sort(list.begin(), list.end());
+    EXPECT_EQ(list, (std::vector<std::string> { "src/alpha_rtl.vhdl", "src/pkg_body.vhdl" }));
+}
+
+TEST_F(DependencyGraphTest, ReanalysedFilesReachTheUsersOfAllTheirUnits) {
+    write("src/pkg.vhdl", "package pkg is\nend package;\npackage body pkg is\nend package body;\n");
+    write("src/alpha.vhdl", "use work.pkg.all;\nentity alpha is\nend entity;\n");
+    write("src/alpha_rtl.vhdl", "architecture rtl of alpha is\nbegin\nend architecture;\n");
+    write_entity("src/top.vhdl", "top", "use work.alpha;");
+    vm::DependencyGraph(vm::Options {}).save_cache();
+
+    // Analysing pkg.vhdl again for its body gives the unchanged package a new date
+    write("src/pkg.vhdl", "package pkg is\nend package;\npackage body pkg is\n constant c : integer := 1;\nend package body;\n");
+    auto list = vm::DependencyGraph().get_update_list();
+    std::sort(list.begin(), list.end());
+    EXPECT_EQ(list, (std::vector<std::string> { "src/alpha.vhdl", "src/alpha_rtl.vhdl", "src/pkg.vhdl", "src/top.vhdl" }));
+}
+
+TEST_F(DependencyGraphTest, CosmeticChangesRebuildNothing) {
+    write("src/pkg.vhdl", "package pkg is\n constant c : integer := 1;\nend package;\n");
+    write_entity("src/alpha.vhdl", "alpha", "use work.pkg.all;");
+    vm::DependencyGraph graph;
+    graph.record_elaboration("alpha");
+    graph.save_cache();
+
+    // Comments, whitespace and case leave the units as they are in the library
+    write("src/pkg.vhdl", "-- Constants\nPACKAGE pkg IS\n\n  constant C : integer := 1; -- one\nEND PACKAGE;\n");
+    EXPECT_TRUE(vm::DependencyGraph().get_update_list().empty());
+    EXPECT_TRUE(vm::DependencyGraph().is_elaborated("alpha"));
+
+    graph = vm::DependencyGraph();
+    write("src/pkg.vhdl", "package pkg is\n constant c : integer := 1;\n constant d : integer := 2;\nend package;\n");
+    graph.update({"src/pkg.vhdl"});
+    EXPECT_EQ(graph.get_update_list(), (std::vector<std::string> { "src/pkg.vhdl", "src/alpha.vhdl" }));
+    EXPECT_FALSE(graph.is_elaborated("alpha"));
+
+    // The same in watch mode
+    graph.commit();
+    write("src/pkg.vhdl", "package pkg is\n  constant c : integer := 1;  constant d : integer := 2;\nend package;\n");
+    graph.update({"src/pkg.vhdl"});
+    EXPECT_TRUE(graph.get_update_list().empty());
+}
+
+TEST_F(DependencyGraphTest, SubsetSinceRevision) {
+    write("src/pkg.vhd", "package pkg is\nend package;\n");
+    write_entity("src/alpha.vhd", "alpha", "use work.pkg.all;");
+    write_entity("src/beta.vhdl", "beta");
+    write_entity("src/gamma.vhdl", "gamma");
+    ASSERT_EQ(std::system("git init -q . && git add src && git -c user.name=t -c user.email=t@t commit -qm init"), 0);
+
+    // Edited, untracked and unrelated files, with either extension
+    write_entity("src/alpha.vhd", "alpha", "use work.pkg.all; -- changed");
+    write_entity("src/delta.vhdl", "delta");
+    write("notes.txt", "not a source");
+
+    auto subset = vm::DependencyGraph(vm::Options { .since = "HEAD" }).get_minimal_subset();
+    std::sort(subset.begin(), subset.end());
+    EXPECT_EQ(subset, (std::vector<std::string> { "src/alpha.vhd", "src/delta.vhdl", "src/pkg.vhd" }));
+}
+
+TEST_F(DependencyGraphTest, ResumesFailedBuild) {
+    write("src/pkg.vhdl", "package pkg is\n constant c : integer := 1;\nend package;\n");
+    write_entity("src/alpha.vhdl", "alpha", "use work.pkg.all;");
+    write_entity("src/top.vhdl", "top", "use work.alpha;");
+    vm::DependencyGraph(vm::Options {}).save_cache();
+
+    // Only the package made it into the library before alpha failed
+    write("src/pkg.vhdl", "package pkg is\n constant c : integer := 2;\nend package;\n");
+    vm::BuildPlan plan = vm::DependencyGraph().get_build_plan();
+    ASSERT_EQ(plan.size(), 3);
+    {
+        vm::Journal journal(".vhdlmake.journal");
+        journal.pending({ plan[0].path, plan[1].path, plan[2].path });
+        journal.done({ { .path = plan[0].path, .done = true, .hash = plan[0].hash, .duration = 10 } });
+    }
+
+    // A record cut off by a crash doesn't count
+    std::ofstream(".vhdlmake.journal", std::ios::app) << "done 0000000000000001 5 src/al";
+    EXPECT_EQ(vm::Journal::read(".vhdlmake.journal").size(), 4);
+
+    vm::DependencyGraph graph;
+    EXPECT_EQ(graph.get_update_list(), (std::vector<std::string> { "src/alpha.vhdl", "src/top.vhdl" }));
+
+    // Saving the cache takes over the progress
+    graph.save_cache();
+    EXPECT_FALSE(fs::exists(".vhdlmake.journal"));
+}
+
+TEST_F(DependencyGraphTest, ScopedBuildsLeaveTheRestPending) {
+    write("src/pkg.vhdl", "package pkg is\n constant c : integer := 1;\nend package;\n");
+    write_entity("src/tb_alpha.vhdl", "tb_alpha");
+    write_entity("src/beta.vhdl", "beta", "use work.pkg.all;");
+    write_entity("src/tb_beta.vhdl", "tb_beta", "use work.beta;");
+    vm::DependencyGraph(vm::Options {}).save_cache();
+
+    write("src/pkg.vhdl", "package pkg is\n constant c : integer := 2;\nend package;\n");
+    write_entity("src/tb_alpha.vhdl", "tb_alpha", "use work.pkg.all;");
+
+    vm::DependencyGraph graph;
+    vm::BuildPlan plan = graph.get_build_plan("tb_alpha");
+    ASSERT_EQ(plan.size(), 2);
+    EXPECT_EQ(plan[0].path, "src/pkg.vhdl");
+    EXPECT_EQ(plan[1].path, "src/tb_alpha.vhdl");
+
+    for(auto& step : plan) {
+        step.done = true;
+    }
+    graph.commit(plan);
+    graph.save_cache();
+
+    // Whatever depends on the new package still has to be analysed
+    EXPECT_EQ(vm::DependencyGraph().get_update_list(), (std::vector<std::string> { "src/beta.vhdl", "src/tb_beta.vhdl" }));
+}
+
+TEST_F(DependencyGraphTest, ScopedBuildsTakeWholeFiles) {
+    write("src/util.vhdl", "package util is\n constant c : integer := 1;\nend package;\n");
+    write("src/pkg.vhdl", "package pkg is\nend package;\nuse work.util.all;\npackage pkg2 is\nend package;\n");
+    write_entity("src/tb.vhdl", "tb", "use work.pkg.all;");
+    write_entity("src/other.vhdl", "other");
+    vm::DependencyGraph(vm::Options {}).save_cache();
+
+    // tb only uses pkg, but analysing pkg.vhdl needs util as well
+    write("src/util.vhdl", "package util is\n constant c : integer := 2;\nend package;\n");
+    write_entity("src/other.vhdl", "other", "use work.util.all;");
+    vm::BuildPlan plan = vm::DependencyGraph().get_build_plan("tb");
+    ASSERT_EQ(plan.size(), 3);
+    EXPECT_EQ(plan[0].path, "src/util.vhdl");
+    EXPECT_EQ(plan[1].path, "src/pkg.vhdl");
+    EXPECT_EQ(plan[2].path, "src/tb.vhdl");
+
+    // Every step can become ready
+    std::vector<int> in(plan.size(), 0);
+    for(const auto& step : plan) {
+        for(size_t dep : step.dependants) {
+            in[dep]++;
+        }
+    }
+    for(size_t i = 0; i < plan.size(); i++) {
+        EXPECT_EQ(plan[i].in, in[i]) << plan[i].path;
+    }
+}
+
+TEST_F(DependencyGraphTest, FindsTestbenches) {
+    write("src/dut.vhdl", "entity dut is\n  port (a : in bit);\nend entity;\narchitecture rtl of dut is\nbegin\nend architecture;\n");
+    write_entity("src/tb_dut.vhdl", "tb_dut", "use work.dut;");
+    write_entity("src/wrapper.vhdl", "wrapper");
+    write_entity("src/tb_wrapper.vhdl", "tb_wrapper", "use work.wrapper;");
+    write("src/no_arch.vhdl", "entity no_arch is\nend entity;\n");
+
+    // Entities without ports that nothing instantiates and that can be elaborated
+    vm::DependencyGraph graph;
+    EXPECT_EQ(graph.get_testbenches(), (std::vector<std::string> { "tb_dut", "tb_wrapper" }));
+    EXPECT_EQ(graph.get_testbenches("TB_D*"), std::vector<std::string> { "tb_dut" });
+}
+
+// Edges of a build.ninja, enough of the syntax for what write_ninja produces
+struct NinjaFile {
+    struct Edge {
+        std::vector<std::string> outputs;
+        std::string rule;
+        std::vector<std::string> inputs;
+    };
+
+    std::string version;
+    std::set<std::string> rules { "phony" };
+    std::vector<Edge> edges;
+    std::vector<std::string> defaults;
+
+    // Splits at spaces that aren't escaped, `$ `, `$:` and `$$` become plain characters
+    static std::vector<std::string> paths(const std::string& text) {
+        std::vector<std::string> result(1);
+        for(size_t i = 0; i < text.size(); i++) {
+            if(text[i] == '$' && i + 1 < text.size()) {
+                result.back() += text[++i];
+            } else if(text[i] == ' ') {
+                result.emplace_back();
+            } else {
+                result.back() += text[i];
+            }
+        }
+        std::erase(result, "");
+        return result;
+    }
+
+    explicit NinjaFile(const std::string& text) {
+        std::istringstream stream(text);
+        std::string line;
+        while(std::getline(stream, line)) {
+            if(line.starts_with("ninja_required_version = ")) {
+                version = line.substr(25);
+            } else if(line.starts_with("rule ")) {
+                rules.insert(line.substr(5));
+            } else if(line.starts_with("default ")) {
+                defaults = paths(line.substr(8));
+            } else if(line.starts_with("build ")) {
+                // The outputs end at the first colon that isn't escaped
+                size_t colon = 6;
+                while(line[colon] != ':' || line[colon - 1] == '$') {
+                    colon++;
+                }
+
+                std::vector<std::string> rest = paths(line.substr(colon + 1));
+                Edge edge { .outputs = paths(line.substr(6, colon - 6)), .rule = rest.empty() ? "" : rest[0] };
+                for(size_t i = 1; i < rest.size(); i++) {
+                    if(rest[i] != "|") {
+                        edge.inputs.push_back(rest[i]);
+                    }
+                }
+                edges.push_back(std::move(edge));
+            }
+        }
+    }
+
+    const Edge* producer(const std::string& path) const {
+        for(const auto& edge : edges) {
+            if(std::find(edge.outputs.begin(), edge.outputs.end(), path) != edge.outputs.end()) {
+                return &edge;
+            }
+        }
+        return nullptr;
+    }
+};
+
+TEST_F(DependencyGraphTest, WritesNinjaFile) {
+    write("src/pkg.vhdl", "package pkg is\nend package;\n");
+    write_entity("src/my top.vhdl", "top", "use work.pkg.all;");
+
+    std::ostringstream stream;
+    ASSERT_TRUE(vm::DependencyGraph().write_ninja(stream, { .analyse = "ghdl -a $in && touch $out",
+        .elaborate = "ghdl -e ${entity} && touch $out", .run = "ghdl -r ${entity}", .regenerate = "vhdlmake ninja" }));
+    NinjaFile ninja(stream.str());
+
+    // The console pool needs 1.5
+    EXPECT_EQ(ninja.version, "1.5");
+
+    // Every input is a source or made by another edge, every output only by one
+    std::set<std::string> outputs;
+    for(const auto& edge : ninja.edges) {
+        EXPECT_TRUE(ninja.rules.contains(edge.rule)) << edge.rule;
+        for(const auto& output : edge.outputs) {
+            EXPECT_TRUE(outputs.insert(output).second) << output;
+        }
+        for(const auto& input : edge.inputs) {
+            EXPECT_TRUE(ninja.producer(input) != nullptr || fs::exists(input)) << input;
+        }
+    }
+    for(const auto& target : ninja.defaults) {
+        EXPECT_NE(ninja.producer(target), nullptr) << target;
+    }
+
+    const auto* top = ninja.producer(".vhdlmake.ninja/src/my top.vhdl.stamp");
+    ASSERT_NE(top, nullptr);
+    EXPECT_EQ(top->inputs, (std::vector<std::string> { "src/my top.vhdl", ".vhdlmake.ninja/src/pkg.vhdl.stamp" }));
+
+    // mcode GHDL writes no binary, elaborating leaves a stamp
+    const auto* run = ninja.producer("run-top");
+    ASSERT_NE(run, nullptr);
+    EXPECT_EQ(run->inputs, std::vector<std::string> { ".vhdlmake.ninja/top.elab" });
+    const auto* elaborate = ninja.producer(".vhdlmake.ninja/top.elab");
+    ASSERT_NE(elaborate, nullptr);
+    EXPECT_EQ(elaborate->rule, "elaborate");
+    EXPECT_EQ(elaborate->inputs.size(), 2);
+
+    // Checked on every build, an edge without inputs would never run again
+    const auto* regenerate = ninja.producer("build.ninja");
+    ASSERT_NE(regenerate, nullptr);
+    ASSERT_EQ(regenerate->inputs.size(), 1);
+    const auto* always = ninja.producer(regenerate->inputs[0]);
+    ASSERT_NE(always, nullptr);
+    EXPECT_EQ(always->rule, "phony");
+    EXPECT_TRUE(always->inputs.empty());
+    EXPECT_FALSE(fs::exists(regenerate->inputs[0]));
+
+    // Let ninja itself read the file where it is installed
+    if(std::system("ninja --version > /dev/null 2>&1") == 0) {
+        write("build.ninja", stream.str());
+        EXPECT_EQ(std::system("ninja -n > /dev/null 2>&1"), 0);
+    }
+
+    // Ninja has no way to write a line break in a path
+    write("src/broken\nname.vhdl", "package broken is\nend package;\n");
+    std::ostringstream rejected;
+    EXPECT_FALSE(vm::DependencyGraph().write_ninja(rejected, {}));
+}
+
+TEST_F(DependencyGraphTest, AnswersQueriesFromCachedUnits) {
+    write("src/pkg.vhdl", "package pkg is\nend package;\n");
+    write("src/alpha.vhdl", "entity alpha is\nend entity;\n");
+    write("src/alpha_rtl.vhdl", "use work.pkg.all;\narchitecture rtl of alpha is\nbegin\nend architecture;\n");
+    write_entity("src/top.vhdl", "top", "use work.alpha;");
+
+    std::vector<vm::Unit> units;
+    for(const std::string path : {"src/pkg.vhdl", "src/alpha.vhdl", "src/alpha_rtl.vhdl", "src/top.vhdl"}) {
+        units.push_back(vm::Unit::from_file(path));
+    }
+    vm::DependencyGraph graph(units, {});
+
+    EXPECT_TRUE(graph.contains("Top"));
+    EXPECT_TRUE(graph.contains("src/pkg.vhdl"));
+    EXPECT_FALSE(graph.contains("missing"));
+
+    // The architecture in its own file is what makes alpha depend on pkg
+    EXPECT_EQ(graph.get_dependencies("top", false), (std::vector<std::string> { "src/alpha.vhdl", "src/alpha_rtl.vhdl", "src/pkg.vhdl" }));
+    EXPECT_EQ(graph.get_dependencies("src/pkg.vhdl", true), (std::vector<std::string> { "src/alpha.vhdl", "src/alpha_rtl.vhdl", "src/top.vhdl" }));
+    EXPECT_EQ(graph.get_path("top", "pkg"), (std::vector<std::string> {
+        "entity top (src/top.vhdl)", "entity alpha (src/alpha.vhdl)",
+        "architecture alpha(rtl) (src/alpha_rtl.vhdl)", "package pkg (src/pkg.vhdl)" }));
+    EXPECT_TRUE(graph.get_path("pkg", "top").empty());
+
+    std::stringstream json;
+    graph.write_json(json);
+    EXPECT_NE(json.str().find("{\"id\": 0, \"kind\": \"entity\", \"name\": \"alpha\", \"file\": \"src/alpha.vhdl\", \"dependencies\": []}"), std::string::npos);
+}
@@ -0,0 +1,46 @@
+#include "gtest/gtest.h"
+#include "Executor.hpp"
+
+#include <chrono>
+#include <map>
+
+TEST(Executor, CollectsOutputAndStatus) {
+    vm::Executor executor;
+    vm::Executor::JobId ok = executor.start({ "sh", "-c", "echo out; echo err >&2" });
+    vm::Executor::JobId failed = executor.start({ "sh", "-c", "exit 3" });
+    vm::Executor::JobId missing = executor.start({ "vhdlmake-missing-program" });
+
+    std::map<vm::Executor::JobId, vm::Executor::Result> results;
+    while(results.size() < 3) {
+        for(auto& result : executor.wait()) {
+            results.emplace(result.id, std::move(result));
+        }
+    }
+
+    EXPECT_EQ(results[ok].status, 0);
+    EXPECT_EQ(results[ok].output, "out\nerr\n");
+    EXPECT_EQ(results[failed].status, 3);
+    EXPECT_EQ(results[missing].status, 127);
+    EXPECT_EQ(executor.running(), 0);
+}
+
+TEST(Executor, WaitTimesOutAndStopsJobs) {
+    using Clock = std::chrono::steady_clock;
+    vm::Executor executor;
+    vm::Executor::JobId id = executor.start({ "sleep", "10" });
+
+    Clock::time_point start = Clock::now();
+    EXPECT_TRUE(executor.wait(50).empty());
+    EXPECT_EQ(executor.running(), 1);
+
+    executor.stop(id);
+    std::vector<vm::Executor::Result> results;
+    while(results.empty()) {
+        results = executor.wait();
+    }
+
+    ASSERT_EQ(results.size(), 1);
+    EXPECT_EQ(results[0].id, id);
+    EXPECT_EQ(results[0].status, 128 + SIGKILL);
+    EXPECT_LT(Clock::now() - start, std::chrono::seconds(5));
+}
@@ -0,0 +1,27 @@
+#include "gtest/gtest.h"
+#include "Hash.hpp"
+
+#include <string>
+
+// Reference values from the xxHash specification / reference implementation
+TEST(Hash, MatchesXXH64) {
+    EXPECT_EQ(vm::hash64(""), 0xEF46DB3751D8E999ULL);
+    EXPECT_EQ(vm::hash64("a"), 0xD24EC4F1A98C6E5BULL);
+    EXPECT_EQ(vm::hash64("abc"), 0x44BC2CF5AD770999ULL);
+    EXPECT_EQ(vm::hash64("Nobody inspects the spammish repetition"), 0xFBCEA83C8A378BF1ULL);
+}
+
+TEST(Hash, StreamingMatchesOneShot) {
+    std::string data;
+    for(int i = 0; i < 1000; i++) {
+        data += static_cast<char>(i * 31 + 7);
+    }
+
+    for(size_t chunk : {1, 3, 7, 31, 32, 33, 64, 999}) {
+        vm::Hasher hasher;
+        for(size_t pos = 0; pos < data.size(); pos += chunk) {
+            hasher.update(std::string_view(data).substr(pos, chunk));
+        }
+        EXPECT_EQ(hasher.digest(), vm::hash64(data)) << "chunk size " << chunk;
+    }
+}
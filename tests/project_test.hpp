@@ -0,0 +1,48 @@
+#ifndef PROJECT_TEST_HPP
+#define PROJECT_TEST_HPP
+
+#include "gtest/gtest.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+// Runs every test in a fresh, empty directory that is also the working directory
+class ProjectTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        previous = std::filesystem::current_path();
+        directory = std::filesystem::temp_directory_path() / ("vhdlmake_test_" + std::to_string(getpid()));
+        std::filesystem::remove_all(directory);
+        std::filesystem::create_directories(directory);
+        std::filesystem::current_path(directory);
+    }
+
+    void TearDown() override {
+        std::filesystem::current_path(previous);
+        std::filesystem::remove_all(directory);
+    }
+
+    // Creates the parent directories as needed
+    void write(const std::filesystem::path& path, const std::string& content = "") {
+        if(path.has_parent_path()) {
+            std::filesystem::create_directories(path.parent_path());
+        }
+        std::ofstream file(path);
+        file << content;
+    }
+
+    std::string read(const std::filesystem::path& path) {
+        std::ifstream file(path);
+        std::stringstream content;
+        content << file.rdbuf();
+        return content.str();
+    }
+
+    std::filesystem::path previous;
+    std::filesystem::path directory;
+};
+
+#endif
@@ -0,0 +1,42 @@
+#include "gtest/gtest.h"
+#include "project_test.hpp"
+#include "Scanner.hpp"
+
+using ScannerTest = ProjectTest;
+
+TEST_F(ScannerTest, FindsSourcesAndAppliesIgnoreRules) {
+    write("src/a.vhdl");
+    write("src/b.vhd");
+    write("src/notes.txt");
+    write(".git/objects/c.vhdl");
+    write("ghw/d.vhdl");
+    write("build/e.vhdl");
+    write("src/gen/f.vhdl");
+    write("src/old_g.vhdl");
+    write("lib/build/h.vhdl");
+    write(".vhdlmakeignore", "# generated\n/build/\nsrc/gen/\nold_*.vhdl\n");
+
+    vm::Scanner scanner(directory.string());
+    EXPECT_EQ(scanner.scan(), (std::vector<std::string> { "lib/build/h.vhdl", "src/a.vhdl", "src/b.vhd" }));
+}
+
+TEST_F(ScannerTest, ReusesUnchangedDirectories) {
+    write("src/a.vhdl");
+    write("src/sub/b.vhdl");
+
+    vm::Scanner first(directory.string());
+    first.scan();
+
+    // Pretend the first scan happened long after the directories were modified
+    vm::DirectorySnapshot snapshot = first.get_snapshot();
+    snapshot.scanned_at += int64_t(60) * 1000000000;
+
+    // Still finds files of changed directories
+    write("src/sub/c.vhdl");
+    vm::Scanner second(directory.string());
+    EXPECT_EQ(second.scan(snapshot), (std::vector<std::string> { "src/a.vhdl", "src/sub/b.vhdl", "src/sub/c.vhdl" }));
+
+    // An unchanged directory is not listed again, so its stale listing is used
+    snapshot.directories[0].files.push_back("cached.vhdl");
+    EXPECT_EQ(vm::Scanner(directory.string()).scan(snapshot).front(), "cached.vhdl");
+}
@@ -0,0 +1,55 @@
+#include "gtest/gtest.h"
+#include "TestReport.hpp"
+
+#include <sstream>
+
+static std::vector<vm::TestResult> results() {
+    return {
+        { .entity = "tb_adder", .status = vm::TestStatus::PASSED, .seconds = 0.5 },
+        { .entity = "tb_<fifo>", .status = vm::TestStatus::FAILED, .seconds = 1.25, .output = "a < b & \"c\"\x01\n" },
+        { .entity = "tb_slow", .status = vm::TestStatus::TIMEOUT, .seconds = 2 },
+        { .entity = "tb_broken", .status = vm::TestStatus::ERROR, .output = "tab\there\n" }
+    };
+}
+
+TEST(TestReport, WritesJUnit) {
+    std::ostringstream stream;
+    vm::write_junit(stream, results());
+
+    EXPECT_EQ(stream.str(),
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<testsuites tests=\"4\" failures=\"1\" errors=\"2\" time=\"3.75\">\n"
+        "  <testsuite name=\"vhdlmake\" tests=\"4\" failures=\"1\" errors=\"2\" time=\"3.75\">\n"
+        "    <testcase name=\"tb_adder\" classname=\"work\" time=\"0.5\">\n"
+        "    </testcase>\n"
+        "    <testcase name=\"tb_&lt;fifo&gt;\" classname=\"work\" time=\"1.25\">\n"
+        "      <failure message=\"simulation failed\"/>\n"
+        "      <system-out>a &lt; b &amp; &quot;c&quot;\n</system-out>\n"
+        "    </testcase>\n"
+        "    <testcase name=\"tb_slow\" classname=\"work\" time=\"2\">\n"
+        "      <error message=\"timed out\"/>\n"
+        "    </testcase>\n"
+        "    <testcase name=\"tb_broken\" classname=\"work\" time=\"0\">\n"
+        "      <error message=\"elaboration failed\"/>\n"
+        "      <system-out>tab\there\n</system-out>\n"
+        "    </testcase>\n"
+        "  </testsuite>\n"
+        "</testsuites>\n");
+}
+
+TEST(TestReport, WritesJson) {
+    std::ostringstream stream;
+    vm::write_json(stream, results());
+
+    EXPECT_EQ(stream.str(),
+        "{\"tests\": [\n"
+        "  {\"name\": \"tb_adder\", \"status\": \"passed\", \"time\": 0.5, \"output\": \"\"},\n"
+        "  {\"name\": \"tb_<fifo>\", \"status\": \"failed\", \"time\": 1.25, \"output\": \"a < b & \\\"c\\\"\\u0001\\u000a\"},\n"
+        "  {\"name\": \"tb_slow\", \"status\": \"timeout\", \"time\": 2, \"output\": \"\"},\n"
+        "  {\"name\": \"tb_broken\", \"status\": \"error\", \"time\": 0, \"output\": \"tab\\u0009here\\u000a\"}\n"
+        "]}\n");
+
+    std::ostringstream empty;
+    vm::write_json(empty, {});
+    EXPECT_EQ(empty.str(), "{\"tests\": [\n]}\n");
+}
@@ -0,0 +1,147 @@
+#include "gtest/gtest.h"
+#include "Unit.hpp"
+#include "Lexer.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static vm::Unit parse_source(const std::string& source) {
+    fs::path path = fs::temp_directory_path() / ("vhdlmake_unit_" + std::to_string(getpid()) + ".vhdl");
+    {
+        std::ofstream file(path);
+        file << source;
+    }
+
+    vm::Unit unit = vm::Unit::from_file(path.string());
+    fs::remove(path);
+    return unit;
+}
+
+static std::vector<std::string> lex(const std::string& source) {
+    vm::Lexer lexer(source);
+    std::vector<std::string> tokens;
+    for(auto token = lexer.next(); !token.empty(); token = lexer.next()) {
+        tokens.emplace_back(token);
+    }
+    return tokens;
+}
+
+TEST(Lexer, SkipsCommentsAndLiterals) {
+    auto tokens = lex("a <= \"-- not a comment\"; -- comment\nb <= '\"'; /* block\n comment */ c'length");
+    std::vector<std::string> expected { "a", "<", "=", ";", "b", "<", "=", ";", "c", "'", "length" };
+    EXPECT_EQ(tokens, expected);
+}
+
+TEST(Lexer, HashDependsOnWholeSource) {
+    vm::Lexer a("entity foo is end; -- one");
+    vm::Lexer b("entity foo is end; -- two");
+    EXPECT_NE(a.hash(), b.hash());
+    EXPECT_EQ(vm::Lexer("x").hash(), vm::Lexer("x").hash());
+}
+
+TEST(Lexer, NormalizedHashIgnoresFormatting) {
+    auto normalized = [](std::string_view source) {
+        vm::Lexer lexer(source);
+        return lexer.normalized_hash(0, source.size());
+    };
+
+    uint64_t hash = normalized("entity foo is\n  constant c : string := \"Ab\";\nend;");
+    EXPECT_EQ(normalized("-- header\nENTITY Foo IS constant C:string:=\"Ab\"; /* x */ END;"), hash);
+    EXPECT_NE(normalized("entity foo is\n  constant c : string := \"AB\";\nend;"), hash);
+    EXPECT_NE(normalized("entity foo is\n  constant cc : string := \"Ab\";\nend;"), hash);
+    EXPECT_NE(normalized("entity \\Foo\\ is end;"), normalized("entity \\foo\\ is end;"));
+}
+
+TEST(Lexer, NormalizedHashCoversLongSegments) {
+    // Longer than the buffer the lexer folds tokens into, with a literal that doesn't fit at all
+    std::string source = "X <= \"" + std::string(1000, 'Q') + "\";";
+    std::string expected = "x < = \"" + std::string(1000, 'Q') + "\" ; ";
+    for(int i = 0; i < 100; i++) {
+        source += " Signal_" + std::to_string(i) + " ;";
+        expected += "signal_" + std::to_string(i) + " ; ";
+    }
+
+    uint64_t segment = vm::hash64(expected);
+    vm::Hasher hasher;
+    hasher.update(std::string_view(reinterpret_cast<const char*>(&segment), sizeof(segment)));
+
+    vm::Lexer lexer(source);
+    EXPECT_EQ(lexer.normalized_hash(0, source.size()), hasher.digest());
+}
+
+TEST(Unit, ParsesDefinitionsAndReferences) {
+    vm::Unit unit = parse_source(
+        "library ieee;\n"
+        "use ieee.std_logic_1164.all;\n"
+        "use work.Types_Pkg.all, work.util2.all;\n"
+        "-- entity commented is\n"
+        "ENTITY Adder4 IS\n"
+        "end entity;\n"
+        "architecture rtl of adder4 is\n"
+        "  component Half_Adder is end component;\n"
+        "begin\n"
+        "  u0: entity work.full_adder(rtl);\n"
+        "  u1: half_adder;\n"
+        "end architecture;\n");
+
+    EXPECT_EQ(unit.definitions, std::vector<std::string> { "adder4" });
+    EXPECT_EQ(unit.references, (std::unordered_set<std::string> { "types_pkg", "util2", "half_adder", "full_adder" }));
+}
+
+TEST(Unit, PackageBodiesReferenceTheirPackage) {
+    vm::Unit unit = parse_source("package body pkg is\nend package body;\n");
+    EXPECT_TRUE(unit.definitions.empty());
+    EXPECT_EQ(unit.references, std::unordered_set<std::string> { "pkg" });
+}
+
+TEST(Unit, SplitsDesignUnits) {
+    vm::Unit unit = parse_source(
+        "library ieee;\n"
+        "use work.types.all;\n"
+        "entity alpha is\n"
+        "end entity;\n"
+        "architecture rtl of alpha is\n"
+        "  use work.util.all;\n"
+        "begin\n"
+        "end architecture;\n"
+        "use work.consts.all;\n"
+        "package pkg is\n"
+        "end package;\n"
+        "package body pkg is\n"
+        "end package body;\n");
+
+    ASSERT_EQ(unit.design_units.size(), 4);
+    EXPECT_EQ(unit.design_units[0].kind, vm::UnitKind::ENTITY);
+    EXPECT_EQ(unit.design_units[0].references, std::unordered_set<std::string> { "types" });
+    EXPECT_EQ(unit.design_units[1].name, "alpha(rtl)");
+    EXPECT_EQ(unit.design_units[1].primary(), "alpha");
+    EXPECT_EQ(unit.design_units[1].references, (std::unordered_set<std::string> { "alpha", "util" }));
+    EXPECT_EQ(unit.design_units[2].kind, vm::UnitKind::PACKAGE);
+    EXPECT_EQ(unit.design_units[2].references, std::unordered_set<std::string> { "consts" });
+    EXPECT_EQ(unit.design_units[3].kind, vm::UnitKind::PACKAGE_BODY);
+    EXPECT_EQ(unit.definitions, (std::vector<std::string> { "alpha", "pkg" }));
+
+    // Every unit has its own hash
+    vm::Unit edited = parse_source(
+        "library ieee;\n"
+        "use work.types.all;\n"
+        "entity alpha is\n"
+        "end entity;\n"
+        "architecture rtl of alpha is\n"
+        "  use work.util.all;\n"
+        "  signal s : bit;\n"
+        "begin\n"
+        "end architecture;\n"
+        "use work.consts.all;\n"
+        "package pkg is\n"
+        "end package;\n"
+        "package body pkg is\n"
+        "end package body;\n");
+    EXPECT_EQ(edited.design_units[0].hash, unit.design_units[0].hash);
+    EXPECT_NE(edited.design_units[1].hash, unit.design_units[1].hash);
+    EXPECT_EQ(edited.design_units[2].hash, unit.design_units[2].hash);
+}